@@ -67,11 +67,21 @@ struct TRS2QVCA : Module {
         getCV1 = &TRS2QVCA::rectify;
         getCV2 = &TRS2QVCA::rectify;
 
+        vca1 = &TRS2QVCA::processVCA<false>;
+        vca2 = &TRS2QVCA::processVCA<false>;
+
     }
 
     float_4 (TRS2QVCA::*getCV1)(float_4 knob, float_4 cv);
     float_4 (TRS2QVCA::*getCV2)(float_4 knob, float_4 cv);
 
+    typedef void (TRS2QVCA::*VCAKernel)(float_4 (TRS2QVCA::*getCV)(float_4, float_4), float_4 knob, StereoInHandler &level,
+        StereoInHandler &in, StereoInHandler &antiIn, StereoOutHandler &out, StereoOutHandler &antiOut);
+
+    // picked by whether each LEVEL input is patched
+    VCAKernel vca1;
+    VCAKernel vca2;
+
     float_4 rectify(float_4 knob, float_4 cv) {
         return clamp(abs(knob + cv), float_4(0.f), float_4(5.f));
     }
@@ -105,6 +115,30 @@ struct TRS2QVCA : Module {
             case 0: getCV2 = &TRS2QVCA::scale;
                 break;
         }
+
+        vca1 = level1.isConnected() ? &TRS2QVCA::processVCA<true> : &TRS2QVCA::processVCA<false>;
+        vca2 = level2.isConnected() ? &TRS2QVCA::processVCA<true> : &TRS2QVCA::processVCA<false>;
+    }
+
+    /** One VCA and its anti output over both sides. With LEVEL unpatched the knob alone sets one control for every voice. */
+    template <bool LEVEL_CV>
+    void processVCA(float_4 (TRS2QVCA::*getCV)(float_4, float_4), float_4 knob, StereoInHandler &level,
+        StereoInHandler &in, StereoInHandler &antiIn, StereoOutHandler &out, StereoOutHandler &antiOut) {
+
+        float_4 fixed = LEVEL_CV ? float_4(0.f) : (this->*getCV)(knob, float_4(0.f)) * float_4(0.2f);
+
+        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
+
+            float_4 control = LEVEL_CV ? (this->*getCV)(knob, level.getLeft(polyChunk)) * float_4(0.2f) : fixed;
+            out.setLeft(control * in.getLeft(polyChunk) + (1 - control) * antiIn.getLeft(polyChunk), polyChunk);
+            antiOut.setLeft(control * antiIn.getLeft(polyChunk) + (1 - control) * in.getLeft(polyChunk), polyChunk);
+
+            control = LEVEL_CV ? (this->*getCV)(knob, level.getRight(polyChunk)) * float_4(0.2f) : fixed;
+            out.setRight(control * in.getRight(polyChunk) + (1 - control) * antiIn.getRight(polyChunk), polyChunk);
+            antiOut.setRight(control * antiIn.getRight(polyChunk) + (1 - control) * in.getRight(polyChunk), polyChunk);
+
+        }
+
     }
 
 
@@ -124,25 +158,8 @@ struct TRS2QVCA : Module {
         float_4 level1Knob = params[LEVEL1_PARAM].getValue();
         float_4 level2Knob = params[LEVEL2_PARAM].getValue();
 
-        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
-
-            float_4 control = (this->*getCV1)(level1Knob, level1.getLeft(polyChunk)) * float_4(0.2f);
-            out1.setLeft(control * in1.getLeft(polyChunk) + (1 - control) * antiIn1.getLeft(polyChunk), polyChunk);
-            antiOut1.setLeft(control * antiIn1.getLeft(polyChunk) + (1 - control) * in1.getLeft(polyChunk), polyChunk);
-
-            control = (this->*getCV1)(level1Knob, level1.getRight(polyChunk)) * float_4(0.2f);
-            out1.setRight(control * in1.getRight(polyChunk) + (1 - control) * antiIn1.getRight(polyChunk), polyChunk);
-            antiOut1.setRight(control * antiIn1.getRight(polyChunk) + (1 - control) * in1.getRight(polyChunk), polyChunk);
-
-            control = (this->*getCV2)(level2Knob, level2.getLeft(polyChunk)) * float_4(0.2f);
-            out2.setLeft(control * in2.getLeft(polyChunk) + (1 - control) * antiIn2.getLeft(polyChunk), polyChunk);
-            antiOut2.setLeft(control * antiIn2.getLeft(polyChunk) + (1 - control) * in2.getLeft(polyChunk), polyChunk);
-                
-            control = (this->*getCV2)(level2Knob, level2.getRight(polyChunk)) * float_4(0.2f);
-            out2.setRight(control * in2.getRight(polyChunk) + (1 - control) * antiIn2.getRight(polyChunk), polyChunk);
-            antiOut2.setRight(control * antiIn2.getRight(polyChunk) + (1 - control) * in2.getRight(polyChunk), polyChunk);
-
-        }
+        (this->*vca1)(getCV1, level1Knob, level1, in1, antiIn1, out1, antiOut1);
+        (this->*vca2)(getCV2, level2Knob, level2, in2, antiIn2, out2, antiOut2);
     }
 };
 
@@ -177,4 +194,5 @@ struct TRS2QVCAWidget : ModuleWidget {
 };
 
 
-Model *modelTRS2QVCA = createModel<TRS2QVCA, TRS2QVCAWidget>("TRS2QVCA");
\ No newline at end of file
+Model *modelTRS2QVCA = createModel<TRS2QVCA, TRS2QVCAWidget>("TRS2QVCA");
+TRS_FOOTPRINT(TRS2QVCA, 1024);
\ No newline at end of file
@@ -73,8 +73,6 @@ struct TRSATTENUATORS : Module {
 
     }
 
-    ZenerClipperBL<float_4> shaper1[2];
-    ZenerClipperBL<float_4> shaper2[2];
 
     void process(const ProcessArgs &args) override {
 
@@ -158,4 +156,5 @@ struct TRSATTENUATORSWidget : ModuleWidget {
 };
 
 
-Model *modelTRSATTENUATORS = createModel<TRSATTENUATORS, TRSATTENUATORSWidget>("TRSATTENUATORS");
\ No newline at end of file
+Model *modelTRSATTENUATORS = createModel<TRSATTENUATORS, TRSATTENUATORSWidget>("TRSATTENUATORS");
+TRS_FOOTPRINT(TRSATTENUATORS, 1024);
\ No newline at end of file
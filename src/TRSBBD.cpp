@@ -23,14 +23,16 @@ struct TRSBBD : Module {
 
     BBD<float> bbds[2];
 
-    float sr = 44100.f;
+    #define BBD_MAX_OVERSAMPLE 8
 
-    #define BBD_OVERSAMPLE 4
+    trs::UpsamplePow2<BBD_MAX_OVERSAMPLE, float> upsamplers[2];
+    trs::DecimatePow2<BBD_MAX_OVERSAMPLE, float> decimators[2];
 
-    UpsamplePow2<BBD_OVERSAMPLE, float> upsamplers[2];
-    DecimatePow2<BBD_OVERSAMPLE, float> decimators[2];
+    float work[BBD_MAX_OVERSAMPLE];
 
-    float work[BBD_OVERSAMPLE];
+    trs::OversampleChoice oversample {BBD_MAX_OVERSAMPLE};
+
+    QualityChoice quality;
 
     StereoInHandler fbIn;
     StereoInHandler timeIn;
@@ -38,6 +40,30 @@ struct TRSBBD : Module {
 
     StereoOutHandler signalOut;
 
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
+
+    IdleDetector idle;
+
+    ModuleProfiler profiler;
+
+    struct BBDFrame {
+        float signal[2];
+        float fb[2];
+        float clock[2];
+    };
+
+    struct StereoFrame {
+        float v[2];
+    };
+
+    BlockBuffer<BBDFrame, StereoFrame> block;
+
+    // specialised on which of FEEDBACK and TIME are patched, an unpatched one is a constant 0V
+    void (TRSBBD::*readControlsFor)(float signal[2], float fb[2], float clock[2]);
+
+    dsp::ClockDivider patchDivider;
+
     TRSBBD() {
 
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -50,6 +76,11 @@ struct TRSBBD : Module {
 
         signalOut.configure(&outputs[SIGNAL_OUTPUT]);
 
+        flushDivider.setDivision(64);
+
+        patchDivider.setDivision(32);
+        selectKernels();
+
         onSampleRateChange();
 
     }
@@ -59,54 +90,215 @@ struct TRSBBD : Module {
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+        TRS_PROFILE_FRAME(profiler);
+
         outputs[SIGNAL_OUTPUT].setChannels(16);
 
-        float timeCV = timeIn.getLeft();
-        timeCV += 5.f;
-        timeCV /= 10.f;
-        timeCV = clamp(timeCV, 0.f, 1.f);
-        timeCV += params[TIME_PARAM].getValue();
-        timeCV = 14000.f * dsp::approxExp2_taylor5(timeCV * 3.f);
-
-        float fb = clamp(params[FEEDBACK_PARAM].getValue() + fbIn.getLeft()/15.f, 0.f, .75f);
-        float in = signalIn.getLeft() + lastL * fb;
-        upsamplers[0].process(in);
-        work[0] = bbds[0].process(upsamplers[0].output[0], timeCV);
-        work[1] = bbds[0].process(upsamplers[0].output[1], timeCV);
-        work[2] = bbds[0].process(upsamplers[0].output[2], timeCV);
-        work[3] = bbds[0].process(upsamplers[0].output[3], timeCV);
-        float out = decimators[0].process(work);
-        // float out = bbds[0].process(in, timeCV);
-        lastL = out;
-        signalOut.setLeft(lastL);
-
-        timeCV = timeIn.getRight();
+        if (patchDivider.process()) {
+            selectKernels();
+        }
+
+        quality.update();
+        if (oversample.update(args.sampleRate, qualityOversampleRate(quality.tier))) {
+            applyOversample(args.sampleTime);
+        }
+
+        if (block.update()) {
+            processBlock();
+            return;
+        }
+
+        if (!idle.wake(hmax(signalIn.peak()))) {
+            return;
+        }
+
+        float signal[2];
+        float fb[2];
+        float clock[2];
+        (this->*readControlsFor)(signal, fb, clock);
+
+        float in[2];
+        in[0] = signal[0] + lastL * fb[0];
+        in[1] = signal[1] + lastR * fb[1];
+
+        float out[2];
+
+        for (int i = 0; i < 2; i++) {
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_UPSAMPLE);
+                upsamplers[i].process(in[i], work);
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+                for (int k = 0; k < oversample.factor; k++) {
+                    work[k] = bbds[i].process(work[k], clock[i]);
+                }
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_DECIMATE);
+                out[i] = decimators[i].process(work);
+            }
+
+        }
+
+        lastL = out[0];
+        lastR = out[1];
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+            signalOut.setLeft(lastL);
+            signalOut.setRight(lastR);
+        }
+
+        if (idle.settle(std::max(std::fabs(lastL), std::fabs(lastR)))) {
+            silenceOutput(outputs[SIGNAL_OUTPUT]);
+        }
+
+        if (flushDivider.process()) {
+            flushDenormals();
+        }
+
+    }
+
+    void selectKernels(void) {
+        typedef void (TRSBBD::*Kernel)(float signal[2], float fb[2], float clock[2]);
+        static const Kernel kernels[4] = {
+            &TRSBBD::readControls<false, false>,
+            &TRSBBD::readControls<true, false>,
+            &TRSBBD::readControls<false, true>,
+            &TRSBBD::readControls<true, true>
+        };
+        readControlsFor = kernels[fbIn.isConnected() | (timeIn.isConnected() << 1)];
+    }
+
+    template <bool FEEDBACK_CV, bool TIME_CV>
+    void readControls(float signal[2], float fb[2], float clock[2]) {
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_COEFFICIENTS);
+
+        // an unpatched or mono CV sets both sides alike, so the clock is only worked out once
+        float timeL = TIME_CV ? timeIn.getLeft() : 0.f;
+        float timeR = TIME_CV ? timeIn.getRight() : 0.f;
+        clock[0] = readClock(timeL);
+        clock[1] = (timeR == timeL) ? clock[0] : readClock(timeR);
+
+        if (FEEDBACK_CV) {
+            fb[0] = clamp(params[FEEDBACK_PARAM].getValue() + fbIn.getLeft()/15.f, 0.f, .75f);
+            fb[1] = clamp(params[FEEDBACK_PARAM].getValue() + fbIn.getRight()/15.f, 0.f, .75f);
+        } else {
+            fb[0] = clamp(params[FEEDBACK_PARAM].getValue(), 0.f, .75f);
+            fb[1] = fb[0];
+        }
+
+        signal[0] = signalIn.getLeft();
+        signal[1] = signalIn.getRight();
+
+    }
+
+    // the time knob and CV rarely move, so the last clock is held until they do
+    float clockTime = -1.f;
+    float clockHz = 14000.f;
+
+    float readClock(float timeCV) {
         timeCV += 5.f;
         timeCV /= 10.f;
         timeCV = clamp(timeCV, 0.f, 1.f);
         timeCV += params[TIME_PARAM].getValue();
-        timeCV = 14000.f * dsp::approxExp2_taylor5(timeCV * 3.f);
-
-        fb = clamp(params[FEEDBACK_PARAM].getValue() + fbIn.getRight()/15.f, 0.f, .75f);
-        in = signalIn.getRight() + lastR * fb;
-        upsamplers[1].process(in);
-        work[0] = bbds[1].process(upsamplers[1].output[0], timeCV);
-        work[1] = bbds[1].process(upsamplers[1].output[1], timeCV);
-        work[2] = bbds[1].process(upsamplers[1].output[2], timeCV);
-        work[3] = bbds[1].process(upsamplers[1].output[3], timeCV);
-        out = decimators[1].process(work);
-        // out = bbds[1].process(in, timeCV);
-        lastR = out;
-        signalOut.setRight(lastR);
+        if (timeCV != clockTime) {
+            clockTime = timeCV;
+            clockHz = timeToClock(timeCV, 14000.f, 3.f);
+        }
+        return clockHz;
+    }
+
+    /** Block mode: the ports see the block computed one block ago, and each side's line runs over the next block in one go.
+     *  The feedback path is internal to the module, so it still closes sample by sample inside the block. */
+    void processBlock(void) {
+
+        BBDFrame &frame = block.input();
+        (this->*readControlsFor)(frame.signal, frame.fb, frame.clock);
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+            signalOut.setLeft(block.output().v[0]);
+            signalOut.setRight(block.output().v[1]);
+        }
+
+        if (!block.advance()) {
+            return;
+        }
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+
+        for (int i = 0; i < 2; i++) {
+            float last = i ? lastR : lastL;
+            for (int t = 0; t < block.size; t++) {
+                const BBDFrame &in = block.in[t];
+                upsamplers[i].process(in.signal[i] + last * in.fb[i], work);
+                for (int k = 0; k < oversample.factor; k++) {
+                    work[k] = bbds[i].process(work[k], in.clock[i]);
+                }
+                last = decimators[i].process(work);
+                block.out[t].v[i] = last;
+            }
+            (i ? lastR : lastL) = last;
+        }
+
+        flushDenormals();
+
+    }
+
+    // the feedback path keeps recirculating long after the input stops
+    void flushDenormals(void) {
+        int seen = flushDenormal(lastL) + flushDenormal(lastR);
+        for (int i = 0; i < 2; i++) {
+            seen += upsamplers[i].flushDenormals();
+            seen += decimators[i].flushDenormals();
+        }
+        denormals.record(seen);
+    }
+
+    // the line's anti imaging filters are designed for the rate it actually runs at
+    void applyOversample(float sampleTime) {
+        for (int i = 0; i < 2; i++) {
+            upsamplers[i].setFactor(oversample.factor);
+            decimators[i].setFactor(oversample.factor);
+            bbds[i].reformFilters(sampleTime / oversample.factor);
+        }
+    }
 
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "blockSize", json_integer(block.requestedSize.read()));
+        json_object_set_new(rootJ, "oversample", json_integer(oversample.requested.read()));
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ) {
+            block.request(json_integer_value(blockSizeJ));
+        }
+        json_t* oversampleJ = json_object_get(rootJ, "oversample");
+        if (oversampleJ) {
+            oversample.requested.post(json_integer_value(oversampleJ));
+        }
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
     }
 
     void onSampleRateChange() override {
-        
-        sr = APP->engine->getSampleTime();
 
-        bbds[0].reformFilters(sr / 4.f);
-        bbds[1].reformFilters(sr / 4.f);
+        // the oversampling factor and the line's filters follow the new rate at the top of process()
+        // an echo can still be on its way through the line while the output is quiet
+        idle.setTail(1.f, APP->engine->getSampleRate());
 
     }
 
@@ -130,7 +322,21 @@ struct TRSBBDWidget : ModuleWidget {
 
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 113.501)), module, TRSBBD::SIGNAL_OUTPUT));
     }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSBBD *module = dynamic_cast<TRSBBD*>(this->module);
+        appendQualityMenu(menu, &module->quality);
+        trs::appendOversampleMenu(menu, &module->oversample);
+        appendBlockMenu(menu, &module->block);
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
+#ifdef TRS_PROFILE
+        appendProfileMenu(menu, &module->profiler, "TRSBBD");
+#endif
+    }
 };
 
 
 Model *modelTRSBBD = createModel<TRSBBD, TRSBBDWidget>("TRSBBD");
+TRS_FOOTPRINT(TRSBBD, 24 * 1024);
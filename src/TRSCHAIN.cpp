@@ -0,0 +1,252 @@
+#include "stages.hpp"
+
+
+struct TRSCHAIN : Module {
+    enum ParamIds {
+        DRIVE_PARAM,
+        FREQ_PARAM,
+        RES_PARAM,
+        DEPTH_PARAM,
+        BIAS_PARAM,
+        TONE_PARAM,
+        PHASE_PARAM,
+        PHASE_FB_PARAM,
+        TIME_PARAM,
+        FEEDBACK_PARAM,
+        NUM_PARAMS
+    };
+    enum InputIds {
+        IN_INPUT,
+        FREQ_INPUT,
+        NUM_INPUTS
+    };
+    enum OutputIds {
+        OUT_OUTPUT,
+        NUM_OUTPUTS
+    };
+    enum LightIds {
+        NUM_LIGHTS
+    };
+
+    enum ChainOrders {
+        PRE_VCF_SINCOS_PHASER_BBD,
+        PRE_SINCOS_VCF_PHASER_BBD,
+        SINCOS_XOVER_VCF_PHASER_BBD,
+        PRE_VCF_PHASER_BBD,
+        NUM_ORDERS
+    };
+
+    StereoInHandler signalIn;
+    StereoInHandler freqCV;
+
+    StereoOutHandler signalOut;
+
+    ChainEngineImpl<PreStage, VCFStage, SincosStage, PhaserStage, BBDStage> preVcfSincos;
+    ChainEngineImpl<PreStage, SincosStage, VCFStage, PhaserStage, BBDStage> preSincosVcf;
+    ChainEngineImpl<SincosStage, XoverStage, VCFStage, PhaserStage, BBDStage> sincosXoverVcf;
+    ChainEngineImpl<PreStage, VCFStage, PhaserStage, BBDStage> preVcf;
+
+    // only the selected chain is ever touched by process(), the others stay out of the cache
+    ChainEngine * engines[NUM_ORDERS];
+
+    ConfigMailbox<int> order {PRE_VCF_SINCOS_PHASER_BBD};
+    // the order being heard, and the one being faded out while switching
+    SwitchCrossfade<int> orderFade {PRE_VCF_SINCOS_PHASER_BBD};
+
+    ChainControls controls;
+
+    QualityChoice quality;
+
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
+
+    TRSCHAIN() {
+        config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+        configParam(DRIVE_PARAM, 0.f, 4.f, 1.f, "");
+        configParam(FREQ_PARAM, -5.f, 5.f, 5.f, "");
+        configParam(RES_PARAM, 0.f, 1.f, 0.f, "");
+        configParam(DEPTH_PARAM, 0.f, 1.f, 0.f, "");
+        configParam(BIAS_PARAM, 0.f, 5.f, 0.f, "");
+        configParam(TONE_PARAM, 0.f, 1.f, 1.f, "");
+        configParam(PHASE_PARAM, -5.f, 5.f, 0.f, "");
+        configParam(PHASE_FB_PARAM, 0.f, .5f, 0.f, "");
+        configParam(TIME_PARAM, 0.f, 1.f, 0.f, "");
+        configParam(FEEDBACK_PARAM, 0.f, .75f, 0.f, "");
+
+        signalIn.configure(&inputs[IN_INPUT]);
+        freqCV.configure(&inputs[FREQ_INPUT]);
+
+        signalOut.configure(&outputs[OUT_OUTPUT]);
+
+        engines[PRE_VCF_SINCOS_PHASER_BBD] = &preVcfSincos;
+        engines[PRE_SINCOS_VCF_PHASER_BBD] = &preSincosVcf;
+        engines[SINCOS_XOVER_VCF_PHASER_BBD] = &sincosXoverVcf;
+        engines[PRE_VCF_PHASER_BBD] = &preVcf;
+
+        flushDivider.setDivision(64);
+
+        onSampleRateChange();
+
+    }
+
+    void process(const ProcessArgs &args) override {
+
+        DenormalGuard denormalGuard;
+
+        outputs[OUT_OUTPUT].setChannels(16);
+
+        if (quality.update()) {
+            updateSampleTime();
+        }
+
+        controls.sampleTime = args.sampleTime;
+        controls.drive = params[DRIVE_PARAM].getValue();
+        controls.res = params[RES_PARAM].getValue();
+        controls.depth = params[DEPTH_PARAM].getValue();
+        controls.bias = params[BIAS_PARAM].getValue();
+        controls.tone = params[TONE_PARAM].getValue();
+        controls.phase = params[PHASE_PARAM].getValue();
+        controls.phaseFeedback = params[PHASE_FB_PARAM].getValue();
+        controls.time = params[TIME_PARAM].getValue();
+        controls.feedback = params[FEEDBACK_PARAM].getValue();
+
+        controls.pitch = float_4(freqCV.getLeft(), freqCV.getRight(), 0.f, 0.f) + params[FREQ_PARAM].getValue();
+
+        float_4 in = float_4(signalIn.getLeft(), signalIn.getRight(), 0.f, 0.f);
+
+        // the incoming order starts from silence rather than wherever it was left, then warms up on the input
+        if (orderFade.request(order.read())) {
+            engines[orderFade.current()]->reset();
+        }
+
+        float_4 out = engines[orderFade.current()]->process(controls, in);
+
+        if (orderFade.switching) {
+            float_4 old = engines[orderFade.previous()]->process(controls, in);
+            out = old + (out - old) * float_4(orderFade.weight());
+        }
+        orderFade.advance();
+
+        signalOut.setLeft(out[0]);
+        signalOut.setRight(out[1]);
+
+        if (flushDivider.process()) {
+            denormals.record(engines[orderFade.current()]->flushDenormals());
+        }
+
+    }
+
+    void onSampleRateChange() override {
+        quality.update();
+        updateSampleTime();
+    }
+
+    void updateSampleTime(void) {
+
+        float sampleTime = APP->engine->getSampleTime();
+
+        for (int i = 0; i < NUM_ORDERS; i++) {
+            engines[i]->setSampleTime(sampleTime, qualityOversampleRate(quality.tier));
+        }
+
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "order", json_integer(order.read()));
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* orderJ = json_object_get(rootJ, "order");
+        if (orderJ) {
+            // posted rather than snapped, so a running module crossfades into it, on patch load the fade is over in milliseconds
+            order.post(clamp((int) json_integer_value(orderJ), 0, NUM_ORDERS - 1));
+        }
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
+    }
+
+};
+
+
+struct TRSCHAINWidget : ModuleWidget {
+    TRSCHAINWidget(TRSCHAIN *module) {
+        setModule(module);
+        setPanel(APP->window->loadSvg(asset::plugin(pluginInstance, "res/TRSCHAIN.svg")));
+
+        addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+        addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+        addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+        addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(10.16, 26.0)), module, TRSCHAIN::DRIVE_PARAM));
+        addParam(createParamCentered<SifamGrey>(mm2px(Vec(30.48, 26.0)), module, TRSCHAIN::FREQ_PARAM));
+        addParam(createParamCentered<SifamGrey>(mm2px(Vec(50.8, 26.0)), module, TRSCHAIN::RES_PARAM));
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(10.16, 46.0)), module, TRSCHAIN::DEPTH_PARAM));
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(30.48, 46.0)), module, TRSCHAIN::BIAS_PARAM));
+        addParam(createParamCentered<SifamGrey>(mm2px(Vec(50.8, 46.0)), module, TRSCHAIN::TONE_PARAM));
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(20.32, 66.0)), module, TRSCHAIN::PHASE_PARAM));
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(40.64, 66.0)), module, TRSCHAIN::PHASE_FB_PARAM));
+        addParam(createParamCentered<SifamGrey>(mm2px(Vec(20.32, 86.0)), module, TRSCHAIN::TIME_PARAM));
+        addParam(createParamCentered<SifamGrey>(mm2px(Vec(40.64, 86.0)), module, TRSCHAIN::FEEDBACK_PARAM));
+
+        addInput(createInputCentered<HexJack>(mm2px(Vec(10.16, 108.0)), module, TRSCHAIN::IN_INPUT));
+        addInput(createInputCentered<HexJack>(mm2px(Vec(30.48, 108.0)), module, TRSCHAIN::FREQ_INPUT));
+
+        addOutput(createOutputCentered<HexJack>(mm2px(Vec(50.8, 108.0)), module, TRSCHAIN::OUT_OUTPUT));
+    }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSCHAIN *module = dynamic_cast<TRSCHAIN*>(this->module);
+
+        struct OrderHandler : MenuItem {
+            TRSCHAIN *module;
+            int order;
+            void onAction(const event::Action &e) override {
+                module->order.post(order);
+            }
+        };
+
+        struct OrderItem : MenuItem {
+            TRSCHAIN *module;
+            Menu *createChildMenu() override {
+                Menu *menu = new Menu();
+                const std::string orders[] = {
+                    "PRE > VCF > SINCOS > PHASER > BBD",
+                    "PRE > SINCOS > VCF > PHASER > BBD",
+                    "SINCOS > XOVER > VCF > PHASER > BBD",
+                    "PRE > VCF > PHASER > BBD"
+                };
+                for (int i = 0; i < (int) LENGTHOF(orders); i++) {
+                    OrderHandler *menuItem = createMenuItem<OrderHandler>(orders[i], CHECKMARK(module->order.read() == i));
+                    menuItem->module = module;
+                    menuItem->order = i;
+                    menu->addChild(menuItem);
+                }
+                return menu;
+            }
+        };
+
+        menu->addChild(new MenuEntry);
+        OrderItem *order = createMenuItem<OrderItem>("Stage Order");
+        order->module = module;
+        order->rightText = RIGHT_ARROW;
+        menu->addChild(order);
+
+        appendQualityMenu(menu, &module->quality);
+
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
+
+    }
+
+};
+
+
+Model *modelTRSCHAIN = createModel<TRSCHAIN, TRSCHAINWidget>("TRSCHAIN");
+TRS_FOOTPRINT(TRSCHAIN, 96 * 1024);
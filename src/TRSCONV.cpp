@@ -0,0 +1,174 @@
+#include "trs.hpp"
+#include "convolver.hpp"
+
+
+struct TRSCONV : Module, ConvolutionHost {
+    enum ParamIds {
+        MIX_PARAM,
+        LEVEL_PARAM,
+        NUM_PARAMS
+    };
+    enum InputIds {
+        IN_INPUT,
+        NUM_INPUTS
+    };
+    enum OutputIds {
+        OUT_OUTPUT,
+        NUM_OUTPUTS
+    };
+    enum LightIds {
+        NUM_LIGHTS
+    };
+
+    StereoInHandler in;
+    StereoOutHandler out;
+
+    ConvolutionLoader loader;
+    // owned by the audio thread between swaps
+    ConvolutionEngine *engine = NULL;
+
+    VoiceActivity voices;
+    // a pair that wakes starts from an empty history rather than what it held when it went to sleep
+    bool pairAwake[VOICE_PAIRS] = {};
+
+    TRSCONV() {
+        config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+        configParam(MIX_PARAM, 0.f, 1.f, 1.f, "");
+        configParam(LEVEL_PARAM, 0.f, 2.f, 1.f, "");
+
+        in.configure(&inputs[IN_INPUT]);
+        out.configure(&outputs[OUT_OUTPUT]);
+    }
+
+    ~TRSCONV() {
+        delete engine;
+    }
+
+    void process(const ProcessArgs &args) override {
+
+        DenormalGuard denormalGuard;
+
+        ConvolutionEngine *next = loader.swap(engine);
+        if (next != engine) {
+            engine = next;
+            voices.setTail(engine->tailSamples / engine->sampleRate, engine->sampleRate);
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                pairAwake[pair] = false;
+            }
+        }
+
+        outputs[OUT_OUTPUT].setChannels(16);
+
+        // nothing loaded yet, the input passes through
+        if (!engine) {
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                out.setPair(in.getPair(pair), pair);
+            }
+            return;
+        }
+
+        float mix = params[MIX_PARAM].getValue();
+        float_4 wet = float_4(mix * params[LEVEL_PARAM].getValue());
+        float_4 dry = float_4(1.f - mix);
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            float_4 signal = in.getPair(pair);
+
+            if (!voices.wake(pair, abs(signal))) {
+                continue;
+            }
+
+            // left voices 2g and 2g + 1 are channels 2g and 2g + 1, their right sides 8 higher
+            int left = 2 * pair;
+            int right = 8 + 2 * pair;
+            if (!pairAwake[pair]) {
+                // the pair's delay lines come from the UI thread the first time it plays, it stays dry until then
+                if (!engine->claim(pair)) {
+                    out.setPair(dry * signal, pair);
+                    continue;
+                }
+                engine->reset(left);
+                engine->reset(left + 1);
+                engine->reset(right);
+                engine->reset(right + 1);
+                pairAwake[pair] = true;
+            }
+
+            float_4 convolved = float_4(engine->process(left, signal[0]), engine->process(left + 1, signal[1]),
+                engine->process(right, signal[2]), engine->process(right + 1, signal[3]));
+            float_4 mixed = fmadd(wet, convolved, dry * signal);
+
+            // a pair sleeps once the response has rung out
+            if (voices.settle(pair, abs(mixed))) {
+                pairAwake[pair] = false;
+                out.setPair(float_4(0.f), pair);
+                continue;
+            }
+
+            out.setPair(mixed, pair);
+
+        }
+
+    }
+
+    ConvolutionLoader *convolutionLoader() override {
+        return &loader;
+    }
+
+    void onSampleRateChange() override {
+        // the response was resampled for the old rate, it is prepared again for the new one off the audio thread
+        loader.reload(APP->engine->getSampleRate());
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "path", json_string(loader.getPath().c_str()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* pathJ = json_object_get(rootJ, "path");
+        if (json_string_value(pathJ) && *json_string_value(pathJ) && loader.getPath() != json_string_value(pathJ)) {
+            loader.request(json_string_value(pathJ), APP->engine->getSampleRate());
+        }
+    }
+
+};
+
+
+struct TRSCONVWidget : ModuleWidget {
+    TRSCONVWidget(TRSCONV *module) {
+        setModule(module);
+        setPanel(APP->window->loadSvg(asset::plugin(pluginInstance, "res/TRSCONV.svg")));
+
+        addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+        addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+        addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+        addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(15.24, 30.0)), module, TRSCONV::MIX_PARAM));
+        addParam(createParamCentered<SifamBlack>(mm2px(Vec(15.24, 58.0)), module, TRSCONV::LEVEL_PARAM));
+
+        addInput(createInputCentered<HexJack>(mm2px(Vec(8.795, 113.501)), module, TRSCONV::IN_INPUT));
+
+        addOutput(createOutputCentered<HexJack>(mm2px(Vec(21.685, 113.501)), module, TRSCONV::OUT_OUTPUT));
+    }
+
+    void step() override {
+        TRSCONV *module = dynamic_cast<TRSCONV*>(this->module);
+        if (module) {
+            module->loader.collect();
+        }
+        ModuleWidget::step();
+    }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSCONV *module = dynamic_cast<TRSCONV*>(this->module);
+        appendConvolutionMenu(menu, &module->loader);
+    }
+};
+
+
+Model *modelTRSCONV = createModel<TRSCONV, TRSCONVWidget>("TRSCONV");
+TRS_FOOTPRINT(TRSCONV, 2 * 1024);
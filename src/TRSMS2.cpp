@@ -60,6 +60,23 @@ struct TRSMS2 : Module {
         lr2Out.configure(&outputs[LR2_OUTPUT]);
     }
 
+    // M = (L + R) / sqrt 2 and S = (L - R) / sqrt 2, the matrix is its own inverse so it decodes too
+    StereoMatrix msMatrix {0.70710678118f, 0.70710678118f, 0.70710678118f, -0.70710678118f};
+
+    /** Encodes `lrIn` onto M and S, then decodes M and S, each normalled to what was just encoded, back onto `lrOut`. */
+    inline void processSection(StereoInHandler &lrIn, StereoOutHandler &mOut, StereoOutHandler &sOut,
+        StereoInHandler &mIn, StereoInHandler &sIn, StereoOutHandler &lrOut) {
+
+        const float *lr = lrIn.input->getVoltages();
+        float *mid = mOut.output->getVoltages();
+        float *side = sOut.output->getVoltages();
+        msMatrix.process(lr, lr + 8, mid, side);
+
+        const float *midIn = mIn.isConnected() ? mIn.input->getVoltages() : mid;
+        const float *sideIn = sIn.isConnected() ? sIn.input->getVoltages() : side;
+        msMatrix.process(midIn, sideIn, lrOut.output->getVoltages(), lrOut.output->getVoltages(8));
+    }
+
     void process(const ProcessArgs &args) override {
 
         outputs[S1_OUTPUT].setChannels(8);
@@ -70,29 +87,8 @@ struct TRSMS2 : Module {
         outputs[M2_OUTPUT].setChannels(8);
         outputs[LR2_OUTPUT].setChannels(16);
 
-        #define _MS_SCALE float_4(0.70710678118f)
-
-        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
-
-            float_4 s1O = (lr1In.getLeft(polyChunk) - lr1In.getRight(polyChunk)) * _MS_SCALE;
-            float_4 m1O = (lr1In.getLeft(polyChunk) + lr1In.getRight(polyChunk)) * _MS_SCALE;
-
-            s1Out.setLeft(s1O, polyChunk);
-            m1Out.setLeft(m1O, polyChunk);
-
-            float_4 s2O = (lr2In.getLeft(polyChunk) - lr2In.getRight(polyChunk)) * _MS_SCALE;
-            float_4 m2O = (lr2In.getLeft(polyChunk) + lr2In.getRight(polyChunk)) * _MS_SCALE;
-
-            s2Out.setLeft(s2O, polyChunk);
-            m2Out.setLeft(m2O, polyChunk);
-
-            lr1Out.setLeft((m1In.getLeftNormal(m1O, polyChunk) + s1In.getLeftNormal(s1O, polyChunk)) * _MS_SCALE, polyChunk);
-            lr1Out.setRight((m1In.getLeftNormal(m1O, polyChunk) - s1In.getLeftNormal(s1O, polyChunk)) * _MS_SCALE, polyChunk);
-
-            lr2Out.setLeft((m2In.getLeftNormal(m2O, polyChunk) + s2In.getLeftNormal(s2O, polyChunk)) * _MS_SCALE, polyChunk);
-            lr2Out.setRight((m2In.getLeftNormal(m2O, polyChunk) - s2In.getLeftNormal(s2O, polyChunk)) * _MS_SCALE, polyChunk);
-
-        }
+        processSection(lr1In, m1Out, s1Out, m1In, s1In, lr1Out);
+        processSection(lr2In, m2Out, s2Out, m2In, s2In, lr2Out);
 
     }
 };
@@ -125,4 +121,5 @@ struct TRSMS2Widget : ModuleWidget {
 };
 
 
-Model *modelTRSMS2 = createModel<TRSMS2, TRSMS2Widget>("TRSMS2");
\ No newline at end of file
+Model *modelTRSMS2 = createModel<TRSMS2, TRSMS2Widget>("TRSMS2");
+TRS_FOOTPRINT(TRSMS2, 1024);
\ No newline at end of file
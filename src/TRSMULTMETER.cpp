@@ -145,4 +145,5 @@ struct TRSMULTMETERWidget : ModuleWidget {
 };
 
 
-Model *modelTRSMULTMETER = createModel<TRSMULTMETER, TRSMULTMETERWidget>("TRSMULTMETER");
\ No newline at end of file
+Model *modelTRSMULTMETER = createModel<TRSMULTMETER, TRSMULTMETERWidget>("TRSMULTMETER");
+TRS_FOOTPRINT(TRSMULTMETER, 1024);
\ No newline at end of file
@@ -122,4 +122,5 @@ struct TRSOPSWidget : ModuleWidget {
 };
 
 
-Model *modelTRSOPS = createModel<TRSOPS, TRSOPSWidget>("TRSOPS");
\ No newline at end of file
+Model *modelTRSOPS = createModel<TRSOPS, TRSOPSWidget>("TRSOPS");
+TRS_FOOTPRINT(TRSOPS, 1024);
\ No newline at end of file
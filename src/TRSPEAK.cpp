@@ -29,7 +29,18 @@ struct TRSPEAK : Module {
     StereoOutHandler out;
     StereoOutHandler outInv;
 
-    PeakFollower<float_4> followers[2][2];
+    PeakFollower<float_4> followers[VOICE_PAIRS];
+
+    VoiceActivity voices;
+
+    // the knobs set every follower alike, so their times are only handed out when a knob moves
+    float attack = -1.f;
+    float release = -1.f;
+
+    // GATE is high while the envelope is above this, the level a pair goes to sleep under. The envelope only
+    // decays exponentially, so a gate on anything above 0 stayed high until it underflowed, long after the
+    // input had stopped.
+    #define PEAK_GATE_THRESHOLD 1e-4f
 
     TRSPEAK() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -44,37 +55,66 @@ struct TRSPEAK : Module {
         out.configure(&outputs[NONINV_OUTPUT]);
         outInv.configure(&outputs[INV_OUTPUT]);
 
+        onSampleRateChange();
+
     }   
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+
         outputs[GATE_OUTPUT].setChannels(16);
         outputs[NONINV_OUTPUT].setChannels(16);
         outputs[INV_OUTPUT].setChannels(16);
 
-        for (int polyChunk = 0; polyChunk < 2; polyChunk ++) {
+        if (params[ATTACK_PARAM].getValue() != attack || params[RELEASE_PARAM].getValue() != release) {
+            attack = params[ATTACK_PARAM].getValue();
+            release = params[RELEASE_PARAM].getValue();
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                followers[pair].setTimes(attack, release);
+            }
+        }
+
+        float thresh = params[THRESH_PARAM].getValue();
+        float gain = params[GAIN_PARAM].getValue();
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            float_4 signal = in.getPair(pair);
 
-            followers[polyChunk][0].setTimes(params[ATTACK_PARAM].getValue(), params[RELEASE_PARAM].getValue());
-            followers[polyChunk][1].setTimes(params[ATTACK_PARAM].getValue(), params[RELEASE_PARAM].getValue());
+            if (!voices.wake(pair, abs(signal))) {
+                continue;
+            }
 
-            float_4 follow = followers[polyChunk][0].process(in.getLeft(polyChunk));
-            gate.setLeft(ifelse(follow > 0.f, float_4(5.f), float_4(0.f)), polyChunk);
-            follow = clamp(follow - params[THRESH_PARAM].getValue(), 0.f, 10.f);
-            follow *= params[GAIN_PARAM].getValue();
-            out.setLeft(follow, polyChunk);
-            outInv.setLeft(-follow, polyChunk);
+            float_4 follow = followers[pair].process(signal);
+            gate.setPair(ifelse(follow > PEAK_GATE_THRESHOLD, float_4(5.f), float_4(0.f)), pair);
 
-            follow = followers[polyChunk][1].process(in.getRight(polyChunk));
-            gate.setRight(ifelse(follow > 0.f, float_4(5.f), float_4(0.f)), polyChunk);
-            follow = clamp(follow - params[THRESH_PARAM].getValue(), 0.f, 10.f);
-            follow *= params[GAIN_PARAM].getValue();
-            out.setRight(follow, polyChunk);
-            outInv.setRight(-follow, polyChunk);
+            // a pair sleeps once its envelope has decayed, starting over from zero when it wakes
+            if (voices.settle(pair, abs(follow))) {
+                followers[pair] = PeakFollower<float_4>();
+                followers[pair].setTimes(attack, release);
+                gate.setPair(float_4(0.f), pair);
+                out.setPair(float_4(0.f), pair);
+                outInv.setPair(float_4(0.f), pair);
+                continue;
+            }
+
+            follow = clamp(follow - thresh, 0.f, 10.f);
+            follow *= gain;
+            out.setPair(follow, pair);
+            outInv.setPair(-follow, pair);
 
         }
 
     }
 
+    void onSampleRateChange() override {
+        voices.setTail(.01f, APP->engine->getSampleRate());
+        // the follower coefficients depend on the rate, process() hands them out again
+        attack = -1.f;
+        release = -1.f;
+    }
+
 };
 
 
@@ -102,4 +142,5 @@ struct TRSPEAKWidget : ModuleWidget {
 };
 
 
-Model *modelTRSPEAK = createModel<TRSPEAK, TRSPEAKWidget>("TRSPEAK");
\ No newline at end of file
+Model *modelTRSPEAK = createModel<TRSPEAK, TRSPEAKWidget>("TRSPEAK");
+TRS_FOOTPRINT(TRSPEAK, 2 * 1024);
\ No newline at end of file
@@ -28,11 +28,43 @@ struct TRSPHASER : Module {
     StereoOutHandler wet;
     StereoOutHandler mix;
 
-    // fourPolePhaser<float_4> phasers[2][2];
-    ZDFPhaser8 phasers8[2];
-    ZDFPhaser4 phasers4[2];
+    // both sides packed in one phaser
+    StereoPhaser<8> phaser8;
+    StereoPhaser<4> phaser4;
 
-    int use8Pole = 0;
+    // the lowest cutoff is about 15 Hz, a time constant of 1 / (2 pi 15 Hz) = 10.6 ms, the incoming cascade gets five
+    #define PHASER_WARM_SECONDS .053f
+
+    ConfigMailbox<int> use8Pole {0};
+    // true while the 8 pole phaser is the one being heard
+    SwitchCrossfade<bool> poleFade {false};
+
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
+
+    IdleDetector idle;
+
+    ModuleProfiler profiler;
+
+    struct PhaserFrame {
+        float in[2];
+        float freq[2];
+        float fb;
+        float mix;
+    };
+
+    struct PhaserOutFrame {
+        float wet[2];
+        float mix[2];
+    };
+
+    BlockBuffer<PhaserFrame, PhaserOutFrame> block;
+
+    QualityChoice quality;
+    dsp::ClockDivider coefficientDivider;
+
+    // held between coefficient updates
+    float freq[2] = {};
 
     TRSPHASER() {
 
@@ -47,51 +79,220 @@ struct TRSPHASER : Module {
         wet.configure(&outputs[WET_OUTPUT]);
         mix.configure(&outputs[MIX_OUTPUT]);
 
+        flushDivider.setDivision(64);
+
+        onSampleRateChange();
+
     }
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+        TRS_PROFILE_FRAME(profiler);
+
         float Ts = APP->engine->getSampleTime();
 
         outputs[WET_OUTPUT].setChannels(16);
         outputs[MIX_OUTPUT].setChannels(16);
 
-        float inL = in.getLeft();
-        float inR = in.getRight();
+        if (quality.update()) {
+            coefficientDivider.setDivision(qualityCoefficientDivision(quality.tier));
+        }
+        bool refresh = coefficientDivider.process();
+
+        if (block.update()) {
+            processBlock(Ts, refresh);
+            return;
+        }
+
+        if (!idle.wake(hmax(in.peak()))) {
+            return;
+        }
+
+        float_4 signal = float_4(in.getLeft(), in.getRight(), 0.f, 0.f);
 
         float fb = params[FB_PARAM].getValue();
         float cvDepth = params[CVAMT_PARAM].getValue();
 
-        float freq = clamp((cv.getLeft() * cvDepth), -5.f, 5.f);
-        freq = 480.f * (dsp::approxExp2_taylor5(freq + 5.f) / 32.f) * Ts;
-        float phasedL = 0;
-        if (use8Pole) {
-            phasers8[0].setParams(freq, fb);
-            phasedL = phasers8[0].process(inL);
+        float_4 phased;
+
+        bool started = poleFade.request(useEightPole(quality.tier));
+
+        if (refresh || started) {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_COEFFICIENTS);
+
+            readFreqs(Ts, cvDepth);
+
+            setPhaserParams(poleFade.current(), fb);
+            if (poleFade.switching) {
+                setPhaserParams(poleFade.previous(), fb);
+            }
+        }
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_FILTER);
+
+            phased = processPhaser(poleFade.current(), signal);
+
+            // both pole counts run until the fade is over, the incoming one silently at first
+            if (poleFade.switching) {
+                float_4 old = processPhaser(poleFade.previous(), signal);
+                phased = old + (phased - old) * float_4(poleFade.weight());
+            }
+            poleFade.advance();
+        }
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+
+            wet.setLeft(phased[0]);
+            wet.setRight(phased[1]);
+
+            float_4 mixed = phased * .5f + signal * params[MIX_PARAM].getValue();
+
+            mix.setLeft(mixed[0]);
+            mix.setRight(mixed[1]);
+        }
+
+        if (idle.settle(std::max(std::fabs(phased[0]), std::fabs(phased[1])))) {
+            silenceOutput(outputs[WET_OUTPUT]);
+            silenceOutput(outputs[MIX_OUTPUT]);
+        }
+
+        if (flushDivider.process()) {
+            denormals.record(phaser8.flushDenormals() + phaser4.flushDenormals());
+        }
+
+    }
+
+    /** Block mode: the ports see the block computed one block ago, then the phaser runs over the next one. */
+    void processBlock(float Ts, bool refresh) {
+
+        PhaserFrame &frame = block.input();
+        frame.in[0] = in.getLeft();
+        frame.in[1] = in.getRight();
+        frame.fb = params[FB_PARAM].getValue();
+        frame.mix = params[MIX_PARAM].getValue();
+
+        if (refresh) {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_COEFFICIENTS);
+            readFreqs(Ts, params[CVAMT_PARAM].getValue());
+        }
+        frame.freq[0] = freq[0];
+        frame.freq[1] = freq[1];
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+
+            const PhaserOutFrame &out = block.output();
+            wet.setLeft(out.wet[0]);
+            wet.setRight(out.wet[1]);
+            mix.setLeft(out.mix[0]);
+            mix.setRight(out.mix[1]);
+        }
+
+        if (!block.advance()) {
+            return;
+        }
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_FILTER);
+
+        poleFade.request(useEightPole(quality.tier));
+
+        float_4 phased[MAX_BLOCK_SIZE];
+        float_4 faded[MAX_BLOCK_SIZE];
+
+        runPhaser(poleFade.current(), phased);
+
+        if (poleFade.switching) {
+            runPhaser(poleFade.previous(), faded);
+            for (int t = 0; t < block.size; t++) {
+                phased[t] = faded[t] + (phased[t] - faded[t]) * float_4(poleFade.weight(t));
+            }
+        }
+
+        for (int t = 0; t < block.size; t++) {
+            const PhaserFrame &frame = block.in[t];
+            for (int side = 0; side < 2; side++) {
+                block.out[t].wet[side] = phased[t][side];
+                block.out[t].mix[side] = phased[t][side] * .5f + frame.in[side] * frame.mix;
+            }
+        }
+
+        poleFade.advance(block.size);
+
+    }
+
+    // an unpatched or mono CV gives both sides the same sweep, worked out once
+    void readFreqs(float Ts, float cvDepth) {
+        float cvL = cv.getLeft();
+        float cvR = cv.getRight();
+        freq[0] = qualityVoltsToNormal(quality.tier, cvL * cvDepth, 480.f, -5.f, 5.f, Ts);
+        freq[1] = (cvR == cvL) ? freq[0] : qualityVoltsToNormal(quality.tier, cvR * cvDepth, 480.f, -5.f, 5.f, Ts);
+    }
+
+    // eco holds the phaser to 4 poles whatever the menu says
+    bool useEightPole(int tier) {
+        return use8Pole.read() && tier != QUALITY_ECO;
+    }
+
+    void setPhaserParams(bool eightPole, float fb) {
+        if (eightPole) {
+            phaser8.setParams(freq[0], freq[1], fb);
         } else {
-            phasers4[0].setParams(freq, fb);
-            phasedL = phasers4[0].process(inL);
+            phaser4.setParams(freq[0], freq[1], fb);
         }
+    }
+
+    float_4 processPhaser(bool eightPole, float_4 signal) {
+        return eightPole ? phaser8.process(signal) : phaser4.process(signal);
+    }
 
-        freq = clamp((cv.getRight() * cvDepth), -5.f, 5.f);
-        freq = 480.f * (dsp::approxExp2_taylor5(freq + 5.f) / 32.f) * Ts;
-        float phasedR = 0;
-        if (use8Pole) {
-            phasers8[1].setParams(freq, fb);
-            phasedR = phasers8[1].process(inR);
+    void runPhaser(bool eightPole, float_4 *out) {
+        if (eightPole) {
+            runPhaser(phaser8, out);
         } else {
-            phasers4[1].setParams(freq, fb);
-            phasedR = phasers4[1].process(inR);
+            runPhaser(phaser4, out);
         }
+    }
 
-        wet.setLeft(phasedL);
-        wet.setRight(phasedR);
+    // the coefficients are only rebuilt when a frame's controls differ from the one before
+    template <typename PHASER>
+    void runPhaser(PHASER &phaser, float_4 *out) {
+        for (int t = 0; t < block.size; t++) {
+            const PhaserFrame &frame = block.in[t];
+            phaser.setParams(frame.freq[0], frame.freq[1], frame.fb);
+            out[t] = phaser.process(float_4(frame.in[0], frame.in[1], 0.f, 0.f));
+        }
+    }
 
-        float mixAmount = params[MIX_PARAM].getValue();
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "blockSize", json_integer(block.requestedSize.read()));
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        json_object_set_new(rootJ, "poles", json_integer(use8Pole.read()));
+        return rootJ;
+    }
 
-        mix.setLeft(phasedL * .5f + inL * mixAmount);
-        mix.setRight(phasedR * .5f + inR * mixAmount);
+    void dataFromJson(json_t* rootJ) override {
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ) {
+            block.request(json_integer_value(blockSizeJ));
+        }
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
+        json_t* polesJ = json_object_get(rootJ, "poles");
+        if (polesJ) {
+            use8Pole.post(json_integer_value(polesJ) ? 1 : 0);
+        }
+    }
 
+    void onSampleRateChange() override {
+        float sampleRate = APP->engine->getSampleRate();
+        idle.setTail(.1f, sampleRate);
+        poleFade.warmSamples = std::max(SWITCH_WARM_SAMPLES, (int) (PHASER_WARM_SECONDS * sampleRate));
     }
 };
 
@@ -125,7 +326,7 @@ struct TRSPHASERWidget : ModuleWidget {
             TRSPHASER *module;
             int32_t phaserType;
             void onAction(const event::Action &e) override {
-                module->use8Pole = phaserType;
+                module->use8Pole.post(phaserType);
             }
         };
 
@@ -134,10 +335,10 @@ struct TRSPHASERWidget : ModuleWidget {
             Menu *createChildMenu() override {
                 Menu *menu = new Menu();
                 const std::string poles[] = {
-                    "4", "8 (CPU Beware)" 
+                    "4", "8"
                 };
                 for (int i = 0; i < (int) LENGTHOF(poles); i++) {
-                    PolesHandler *menuItem = createMenuItem<PolesHandler>(poles[i], CHECKMARK((module->use8Pole) == i));
+                    PolesHandler *menuItem = createMenuItem<PolesHandler>(poles[i], CHECKMARK(module->use8Pole.read() == i));
                     menuItem->module = module;
                     menuItem->phaserType = i;
                     menu->addChild(menuItem);
@@ -149,12 +350,25 @@ struct TRSPHASERWidget : ModuleWidget {
         menu->addChild(new MenuEntry);
         PolesItem *poles = createMenuItem<PolesItem>("Phaser Poles");
         poles->module = module;
-        poles->rightText = string::f("%d", ((module->use8Pole) + 1) * 4) + " " + RIGHT_ARROW;
+        poles->rightText = string::f("%d", (module->useEightPole(module->quality.target()) + 1) * 4) + " " + RIGHT_ARROW;
         menu->addChild(poles);
 
+        appendQualityMenu(menu, &module->quality);
+
+        appendBlockMenu(menu, &module->block);
+
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
+
+#ifdef TRS_PROFILE
+        appendProfileMenu(menu, &module->profiler, "TRSPHASER");
+#endif
+
     }
 
 };
 
 
-Model *modelTRSPHASER = createModel<TRSPHASER, TRSPHASERWidget>("TRSPHASER");
\ No newline at end of file
+Model *modelTRSPHASER = createModel<TRSPHASER, TRSPHASERWidget>("TRSPHASER");
+TRS_FOOTPRINT(TRSPHASER, 2 * 1024);
\ No newline at end of file
@@ -47,6 +47,12 @@ struct TRSPRE : Module {
     ZenerClipperBL<float_4> clippers[6]; 
 
     dsp::ClockDivider lightDivider;  
+    // smoothing step per light update, scaled with the divider so the lights fade at the same speed on every tier
+    float lightTime = 20.f/44100.f;
+
+    QualityChoice quality;
+
+    ModuleProfiler profiler;
 
     TRSPRE() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -64,55 +70,76 @@ struct TRSPRE : Module {
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+        TRS_PROFILE_FRAME(profiler);
+
         outputs[OUT1_OUTPUT].setChannels(16);
         outputs[OUT2_OUTPUT].setChannels(16);
         outputs[OUT3_OUTPUT].setChannels(16);
 
+        if (quality.update()) {
+            lightDivider.setDivision(qualityLightDivision(quality.tier));
+            lightTime = (20.f/44100.f) * qualityLightDivision(quality.tier) / 16.f;
+        }
+
         for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
 
-            float_4 out = in1.getLeft(polyChunk) * params[GAIN1_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[0].process(out) * 6.5;
-            out1.setLeft(out, polyChunk);
-
-            out = in2.getLeft(polyChunk) * params[GAIN2_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[1].process(out) * 6.5;
-            out2.setLeft(out, polyChunk);
-
-            out = in3.getLeft(polyChunk) * params[GAIN3_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[2].process(out) * 6.5;
-            out3.setLeft(out, polyChunk);
-
-            out = in1.getRight(polyChunk) * params[GAIN1_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[3].process(out) * 6.5;
-            out1.setRight(out, polyChunk);
-
-            out = in2.getRight(polyChunk) * params[GAIN2_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[4].process(out) * 6.5;
-            out2.setRight(out, polyChunk);
-
-            out = in3.getRight(polyChunk) * params[GAIN3_PARAM].getValue();
-            out /= 6.5f;
-            out = clippers[5].process(out) * 6.5;
-            out3.setRight(out, polyChunk);
+            float_4 out[6];
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+
+                out[0] = in1.getLeft(polyChunk) * params[GAIN1_PARAM].getValue();
+                out[0] /= 6.5f;
+                out[0] = clippers[0].process(out[0]) * 6.5;
+
+                out[1] = in2.getLeft(polyChunk) * params[GAIN2_PARAM].getValue();
+                out[1] /= 6.5f;
+                out[1] = clippers[1].process(out[1]) * 6.5;
+
+                out[2] = in3.getLeft(polyChunk) * params[GAIN3_PARAM].getValue();
+                out[2] /= 6.5f;
+                out[2] = clippers[2].process(out[2]) * 6.5;
+
+                out[3] = in1.getRight(polyChunk) * params[GAIN1_PARAM].getValue();
+                out[3] /= 6.5f;
+                out[3] = clippers[3].process(out[3]) * 6.5;
+
+                out[4] = in2.getRight(polyChunk) * params[GAIN2_PARAM].getValue();
+                out[4] /= 6.5f;
+                out[4] = clippers[4].process(out[4]) * 6.5;
+
+                out[5] = in3.getRight(polyChunk) * params[GAIN3_PARAM].getValue();
+                out[5] /= 6.5f;
+                out[5] = clippers[5].process(out[5]) * 6.5;
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+
+                out1.setLeft(out[0], polyChunk);
+                out2.setLeft(out[1], polyChunk);
+                out3.setLeft(out[2], polyChunk);
+                out1.setRight(out[3], polyChunk);
+                out2.setRight(out[4], polyChunk);
+                out3.setRight(out[5], polyChunk);
+            }
         }
 
         if (lightDivider.process()) {
 
+            TRS_PROFILE_SCOPE(profiler, PROFILE_LIGHTS);
+
             float outl = abs(in1.getLeft() * params[GAIN1_PARAM].getValue()) / 5.f;
             float outr = abs(in1.getRight() * params[GAIN1_PARAM].getValue()) / 5.f;
             bool clippingl = outl > 1.f;
             bool clippingr = outr > 1.f;
             bool okl = outl > .2f;
             bool okr = outr > .2f;
-            lights[LOK1_LIGHT].setSmoothBrightness(okl, 20.f/44100.f);
-            lights[ROK1_LIGHT].setSmoothBrightness(okr, 20.f/44100.f);
-            lights[LCLIP1_LIGHT].setSmoothBrightness(clippingl, 20.f/44100.f);
-            lights[RCLIP1_LIGHT].setSmoothBrightness(clippingr, 20.f/44100.f);
+            lights[LOK1_LIGHT].setSmoothBrightness(okl, lightTime);
+            lights[ROK1_LIGHT].setSmoothBrightness(okr, lightTime);
+            lights[LCLIP1_LIGHT].setSmoothBrightness(clippingl, lightTime);
+            lights[RCLIP1_LIGHT].setSmoothBrightness(clippingr, lightTime);
 
             outl = abs(in2.getLeft() * params[GAIN2_PARAM].getValue()) / 5.f;
             outr = abs(in2.getRight() * params[GAIN2_PARAM].getValue()) / 5.f;
@@ -120,10 +147,10 @@ struct TRSPRE : Module {
             clippingr = outr > 1.f;
             okl = outl > .2f;
             okr = outr > .2f;
-            lights[LOK2_LIGHT].setSmoothBrightness(okl, 20.f/44100.f);
-            lights[ROK2_LIGHT].setSmoothBrightness(okr, 20.f/44100.f);
-            lights[LCLIP2_LIGHT].setSmoothBrightness(clippingl, 20.f/44100.f);
-            lights[RCLIP2_LIGHT].setSmoothBrightness(clippingr, 20.f/44100.f);
+            lights[LOK2_LIGHT].setSmoothBrightness(okl, lightTime);
+            lights[ROK2_LIGHT].setSmoothBrightness(okr, lightTime);
+            lights[LCLIP2_LIGHT].setSmoothBrightness(clippingl, lightTime);
+            lights[RCLIP2_LIGHT].setSmoothBrightness(clippingr, lightTime);
 
             outl = abs(in3.getLeft() * params[GAIN3_PARAM].getValue()) / 5.f;
             outr = abs(in3.getRight() * params[GAIN3_PARAM].getValue()) / 5.f;
@@ -131,14 +158,27 @@ struct TRSPRE : Module {
             clippingr = outr > 1.f;
             okl = outl > .2f;
             okr = outr > .2f;
-            lights[LOK3_LIGHT].setSmoothBrightness(okl, 20.f/44100.f);
-            lights[ROK3_LIGHT].setSmoothBrightness(okr, 20.f/44100.f);
-            lights[LCLIP3_LIGHT].setSmoothBrightness(clippingl, 20.f/44100.f);
-            lights[RCLIP3_LIGHT].setSmoothBrightness(clippingr, 20.f/44100.f);
+            lights[LOK3_LIGHT].setSmoothBrightness(okl, lightTime);
+            lights[ROK3_LIGHT].setSmoothBrightness(okr, lightTime);
+            lights[LCLIP3_LIGHT].setSmoothBrightness(clippingl, lightTime);
+            lights[RCLIP3_LIGHT].setSmoothBrightness(clippingr, lightTime);
 
         }
 
     }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
+    }
 };
 
 
@@ -175,7 +215,16 @@ struct TRSPREWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<GreenLight>>(mm2px(Vec(4.649, 92.246)), module, TRSPRE::LOK3_LIGHT));
         addChild(createLightCentered<MediumLight<GreenLight>>(mm2px(Vec(26.498, 92.246)), module, TRSPRE::ROK3_LIGHT));
     }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSPRE *module = dynamic_cast<TRSPRE*>(this->module);
+        appendQualityMenu(menu, &module->quality);
+#ifdef TRS_PROFILE
+        appendProfileMenu(menu, &module->profiler, "TRSPRE");
+#endif
+    }
 };
 
 
-Model *modelTRSPRE = createModel<TRSPRE, TRSPREWidget>("TRSPRE");
\ No newline at end of file
+Model *modelTRSPRE = createModel<TRSPRE, TRSPREWidget>("TRSPRE");
+TRS_FOOTPRINT(TRSPRE, 2 * 1024);
\ No newline at end of file
@@ -36,12 +36,52 @@ struct TRSSINCOS : Module {
     //     return (float_4(16.f) * phase * (pi - phase)) / (float_4(5.f) * pi * pi - float_4(4.f) * phase * (pi - phase));
     // }
 
-    #define SINCOS_OVERSAMPLE 4
+    #define SINCOS_MAX_OVERSAMPLE 8
 
-    UpsamplePow2<SINCOS_OVERSAMPLE, float_4> upsamplers[2][2];
-    DecimatePow2<SINCOS_OVERSAMPLE, float_4> decimators[2][2];
+    // [bank][voice pair], two banks so a new factor can be warmed up and crossfaded in
+    trs::UpsamplePow2<SINCOS_MAX_OVERSAMPLE, float_4> upsamplers[2][VOICE_PAIRS];
+    trs::DecimatePow2<SINCOS_MAX_OVERSAMPLE, float_4> decimators[2][VOICE_PAIRS];
 
-    float_4 work[SINCOS_OVERSAMPLE];
+    float_4 work[SINCOS_MAX_OVERSAMPLE];
+
+    trs::OversampleChoice oversample {SINCOS_MAX_OVERSAMPLE};
+    // the factor each bank runs at
+    SwitchCrossfade<int> factorFade {SINCOS_MAX_OVERSAMPLE};
+
+    QualityChoice quality;
+
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
+
+    VoiceActivity voices;
+
+    ModuleProfiler profiler;
+
+    struct SincosFrame {
+        float_4 v[VOICE_PAIRS];
+    };
+
+    BlockBuffer<SincosFrame> block;
+    // pairs that have to run over the block being gathered
+    bool blockAwake[VOICE_PAIRS] = {};
+
+    // the input and output each pair was last seen to move from, and the input it sleeps on once they have
+    // both held within the idle threshold of these for the whole tail
+    float_4 anchorIn[VOICE_PAIRS] = {};
+    float_4 anchorOut[VOICE_PAIRS] = {};
+    float_4 lastOut[VOICE_PAIRS] = {};
+
+    // [bank][voice pair], set for the pairs that were asleep when their bank was reset
+    bool stale[2][VOICE_PAIRS] = {};
+    // samples left while a pair that woke on a stale bank warms it up on the live input, and the output it
+    // holds meanwhile, see warm()
+    int warming[VOICE_PAIRS] = {};
+    float_4 wakeOut[VOICE_PAIRS] = {};
+
+    // specialised on whether DEPTH is patched, unpatched the knob sets one depth for every voice
+    void (TRSSINCOS::*readShaperInFor)(float_4 shaperIn[VOICE_PAIRS]);
+
+    dsp::ClockDivider patchDivider;
 
     TRSSINCOS() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -54,46 +94,299 @@ struct TRSSINCOS : Module {
 
         output.configure(&outputs[OUT_OUTPUT]);
 
+        flushDivider.setDivision(64);
+
+        patchDivider.setDivision(32);
+        selectKernels();
+
+        onSampleRateChange();
+
     }
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+        TRS_PROFILE_FRAME(profiler);
+
         outputs[OUT_OUTPUT].setChannels(16);
 
-        for (int polyChunk = 0; polyChunk < 2; polyChunk ++) {
+        if (patchDivider.process()) {
+            selectKernels();
+        }
 
-            float_4 depth = clamp((depthCV.getLeft(polyChunk) / float_4(10.f)) + params[DEPTH_PARAM].getValue(), 0.f, 1.f);
-            float_4 in = mono.getLeft(polyChunk) + stereo.getLeft(polyChunk) + params[BIAS_PARAM].getValue();
-            in *= depth;
+        quality.update();
+        oversample.update(args.sampleRate, qualityOversampleRate(quality.tier));
+        if (factorFade.request(oversample.factor)) {
+            prepareBank(factorFade.to);
+        }
 
-            // scale -5 to -5 to -2 to -2
-            in *= float_4(2.f / 5.f);
-            upsamplers[0][polyChunk].process(in);
-            for (int i = 0; i < SINCOS_OVERSAMPLE; i++) {
-                in = upsamplers[0][polyChunk].output[i];
-                work[i] = bhaskaraSine<float_4, int32_4>(in);
+        if (block.update()) {
+            processBlock();
+            return;
+        }
+
+        float_4 shaperIn[VOICE_PAIRS];
+        (this->*readShaperInFor)(shaperIn);
+
+        int bank = factorFade.to;
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            // a held input shapes to a held output, so a pair sleeps on a static input rather than a silent one
+            if (!wakePair(pair, shaperIn[pair])) {
+                continue;
+            }
+
+            float_4 out;
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_UPSAMPLE);
+                upsamplers[bank][pair].process(shaperIn[pair], work);
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+                for (int i = 0; i < factorFade.current(); i++) {
+                    work[i] = bhaskaraSine<float_4, int32_4>(work[i]);
+                }
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_DECIMATE);
+                out = decimators[bank][pair].process(work) * float_4(5.f);
+            }
+
+            if (factorFade.switching) {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+                float_4 old = shape(factorFade.from, pair, shaperIn[pair]);
+                out = old + (out - old) * float_4(factorFade.weight());
             }
-            float_4 out = decimators[0][polyChunk].process(work);            
-            output.setLeft(out * float_4(5.f), polyChunk);
 
-            depth =  clamp((depthCV.getRight(polyChunk) / float_4(5.f)) + params[DEPTH_PARAM].getValue(), 0.f, 1.f);
-            in = mono.getLeft(polyChunk) + stereo.getRight(polyChunk) + params[BIAS_PARAM].getValue();
+            if (warming[pair]) {
+                out = warm(pair, out);
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+                output.setPair(out, pair);
+            }
+
+            // the pair's outputs are left holding their last value while it sleeps, it stays awake while warming
+            float_4 moved = drift(pair, shaperIn[pair], out);
+            if (!warming[pair]) {
+                voices.settle(pair, moved);
+            }
+            lastOut[pair] = out;
+
+        }
+
+        factorFade.advance();
+
+        if (flushDivider.process()) {
+            flushDenormals();
+        }
+
+    }
+
+    void selectKernels(void) {
+        readShaperInFor = depthCV.isConnected() ? &TRSSINCOS::readShaperIn<true> : &TRSSINCOS::readShaperIn<false>;
+    }
+
+    template <bool DEPTH_CV>
+    void readShaperIn(float_4 shaperIn[VOICE_PAIRS]) {
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_COEFFICIENTS);
+
+        // the right side reads its depth CV at twice the scale of the left, and is offset a quarter turn to give the cos
+        const float_4 depthScale = sidePair(1.f / 10.f, 1.f / 5.f);
+        const float_4 offset = sidePair(0.f, .5f);
+
+        float depthParam = params[DEPTH_PARAM].getValue();
+        float bias = params[BIAS_PARAM].getValue();
+
+        float_4 fixedDepth = float_4(clamp(depthParam, 0.f, 1.f));
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            float_4 depth = DEPTH_CV ? clamp(depthCV.getPair(pair) * depthScale + depthParam, 0.f, 1.f) : fixedDepth;
+            // mono feeds the same voices on both sides
+            float_4 in = mono.getLeftPair(pair) + stereo.getPair(pair) + bias;
             in *= depth;
 
             // scale -5 to -5 to -2 to -2
-            in *= float_4(2.f / 5.f);
-            // cos
-            in += float_4(.5f);
-            upsamplers[1][polyChunk].process(in);
-            for (int i = 0; i < SINCOS_OVERSAMPLE; i++) {
-                in = upsamplers[1][polyChunk].output[i];
-                work[i] = bhaskaraSine<float_4, int32_4>(in);
+            shaperIn[pair] = in * float_4(2.f / 5.f) + offset;
+
+        }
+
+    }
+
+    /** Block mode: the ports see the block computed one block ago, and each awake pair's oversamplers run over the next block in one go. */
+    void processBlock(void) {
+
+        SincosFrame &frame = block.input();
+        (this->*readShaperInFor)(frame.v);
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+            blockAwake[pair] |= wakePair(pair, frame.v[pair]);
+        }
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+            const SincosFrame &out = block.output();
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                output.setPair(out.v[pair], pair);
             }
-            out = decimators[1][polyChunk].process(work);            
-            output.setRight(out * float_4(5.f), polyChunk);
+        }
+
+        if (!block.advance()) {
+            return;
+        }
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_NONLINEARITY);
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            if (!blockAwake[pair]) {
+                for (int t = 0; t < block.size; t++) {
+                    block.out[t].v[pair] = lastOut[pair];
+                }
+                continue;
+            }
+            blockAwake[pair] = false;
+
+            for (int t = 0; t < block.size; t++) {
+                block.out[t].v[pair] = shape(factorFade.to, pair, block.in[t].v[pair]);
+            }
+            if (factorFade.switching) {
+                for (int t = 0; t < block.size; t++) {
+                    float_4 old = shape(factorFade.from, pair, block.in[t].v[pair]);
+                    float_4 &out = block.out[t].v[pair];
+                    out = old + (out - old) * float_4(factorFade.weight(t));
+                }
+            }
+
+            float_4 change = float_4(0.f);
+            for (int t = 0; t < block.size; t++) {
+                float_4 &out = block.out[t].v[pair];
+                if (warming[pair]) {
+                    out = warm(pair, out);
+                }
+                change = fmax(change, drift(pair, block.in[t].v[pair], out));
+            }
+            lastOut[pair] = block.out[block.size - 1].v[pair];
+            if (!warming[pair]) {
+                voices.settle(pair, change, block.size);
+            }
+
+        }
+
+        factorFade.advance(block.size);
+
+        flushDenormals();
+
+    }
+
+    /** VoiceActivity::wake() on how far `in` has moved from the input the pair went to sleep on, so an input
+     *  that creeps slowly still wakes it once it has moved further than the threshold in total. A pair that
+     *  wakes on a bank reset while it slept starts warming it up, see warm(). */
+    inline bool wakePair(int pair, float_4 in) {
+        if (!voices.wake(pair, abs(in - anchorIn[pair]))) {
+            return false;
+        }
+        if (stale[0][pair] || stale[1][pair]) {
+            stale[0][pair] = false;
+            stale[1][pair] = false;
+            warming[pair] = SWITCH_WARM_SAMPLES + SWITCH_FADE_SAMPLES;
+            wakeOut[pair] = lastOut[pair];
+        }
+        return true;
+    }
+
+    /** The warm-up a factor switch gives, for one pair: its banks run on the live input while the output holds
+     *  the value the pair slept on, then it crossfades over to them. The cost is spread over the samples
+     *  rather than caught up in one. */
+    inline float_4 warm(int pair, float_4 out) {
+        int position = SWITCH_WARM_SAMPLES + SWITCH_FADE_SAMPLES - warming[pair]--;
+        float w = clamp((float) (position - SWITCH_WARM_SAMPLES) / SWITCH_FADE_SAMPLES, 0.f, 1.f);
+        return wakeOut[pair] + (out - wakeOut[pair]) * float_4(w);
+    }
 
+    /** How far the pair's input and output are from their anchors, for VoiceActivity::settle(). The anchors
+     *  move whenever either does, so the pair only settles once both have stayed put for the whole tail
+     *  rather than changing little from one sample to the next. */
+    inline float_4 drift(int pair, float_4 in, float_4 out) {
+        float_4 moved = fmax(abs(in - anchorIn[pair]), abs(out - anchorOut[pair]));
+        if (hmax(moved) > voices.pairs[pair].threshold) {
+            anchorIn[pair] = in;
+            anchorOut[pair] = out;
         }
+        return moved;
+    }
 
+    /** One oversampled sine through `bank`, the block path and the outgoing bank of a switch. */
+    inline float_4 shape(int bank, int pair, float_4 in) {
+        trs::UpsamplePow2<SINCOS_MAX_OVERSAMPLE, float_4> &up = upsamplers[bank][pair];
+        up.process(in, work);
+        for (int i = 0; i < up.factor; i++) {
+            work[i] = bhaskaraSine<float_4, int32_4>(work[i]);
+        }
+        return decimators[bank][pair].process(work) * float_4(5.f);
+    }
+
+    /** Sets the incoming bank to the new factor from a clean state, it then warms up on the live input before it is heard. */
+    void prepareBank(int bank) {
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+            upsamplers[bank][pair].setFactor(factorFade.slots[bank]);
+            upsamplers[bank][pair].reset();
+            decimators[bank][pair].setFactor(factorFade.slots[bank]);
+            decimators[bank][pair].reset();
+            // sleeping pairs would wake on a cold bank, they warm it up from wakePair() instead
+            stale[bank][pair] = !voices.awake(pair);
+        }
+    }
+
+    void flushDenormals(void) {
+        int seen = 0;
+        for (int bank = 0; bank < 2; bank++) {
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                seen += upsamplers[bank][pair].flushDenormals();
+                seen += decimators[bank][pair].flushDenormals();
+            }
+        }
+        denormals.record(seen);
+    }
+
+    void onSampleRateChange() override {
+        float sampleRate = APP->engine->getSampleRate();
+        // long enough for the oversampling filters to settle on a held input
+        voices.setTail(.01f, sampleRate);
+        // the bank starts at the factor it will run at, rather than fading down from SINCOS_MAX_OVERSAMPLE
+        quality.update();
+        oversample.update(sampleRate, qualityOversampleRate(quality.tier));
+        factorFade.snap(oversample.factor);
+        prepareBank(factorFade.to);
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "blockSize", json_integer(block.requestedSize.read()));
+        json_object_set_new(rootJ, "oversample", json_integer(oversample.requested.read()));
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ) {
+            block.request(json_integer_value(blockSizeJ));
+        }
+        json_t* oversampleJ = json_object_get(rootJ, "oversample");
+        if (oversampleJ) {
+            oversample.requested.post(json_integer_value(oversampleJ));
+        }
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
     }
 };
 
@@ -115,7 +408,21 @@ struct TRSSINCOSWidget : ModuleWidget {
 
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 113.501)), module, TRSSINCOS::OUT_OUTPUT));
     }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSSINCOS *module = dynamic_cast<TRSSINCOS*>(this->module);
+        appendQualityMenu(menu, &module->quality);
+        trs::appendOversampleMenu(menu, &module->oversample);
+        appendBlockMenu(menu, &module->block);
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
+#ifdef TRS_PROFILE
+        appendProfileMenu(menu, &module->profiler, "TRSSINCOS");
+#endif
+    }
 };
 
 
 Model *modelTRSSINCOS = createModel<TRSSINCOS, TRSSINCOSWidget>("TRSSINCOS");
+TRS_FOOTPRINT(TRSSINCOS, 16 * 1024);
@@ -55,21 +55,22 @@ struct TRSSPIN : Module {
 
     void process(const ProcessArgs &args) override {
 
-        float_4 sr = float_4(APP->engine->getSampleRate());
+        float Ts = APP->engine->getSampleTime();
 
-        float_4 baseRateTop = dsp::approxExp2_taylor5(float_4(params[RATE1_PARAM].getValue())) * float_4(.01f)/sr;
-        float_4 baseRateBottom = dsp::approxExp2_taylor5(float_4(params[RATE2_PARAM].getValue())) * float_4(.01f)/sr;
+        float_4 baseRateTop = float_4(params[RATE1_PARAM].getValue());
+        float_4 baseRateBottom = float_4(params[RATE2_PARAM].getValue());
 
         for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
 
             float_4 topPhase = topLFOLeadPhase[polyChunk];
             float_4 bottomPhase = bottomLFOLeadPhase[polyChunk];
 
-            float_4 rate = dsp::approxExp2_taylor5(topLFORate.getLeft(polyChunk) * params[RATE1_ATTEN_PARAM].getValue() + float_4(5.f)) * baseRateTop / float_4(32.f);
+            // .01 Hz at the bottom of the rate knob, 12 octaves of knob plus 10 of CV either side
+            float_4 rate = voltsToNormal(topLFORate.getLeft(polyChunk) * params[RATE1_ATTEN_PARAM].getValue() + baseRateTop, .01f, -10.f, 22.f, Ts);
             topPhase += rate;
             topPhase -= (topPhase >= 1.f) & 1.f;
 
-            rate = dsp::approxExp2_taylor5(bottomLFORate.getLeft(polyChunk) * params[RATE2_ATTEN_PARAM].getValue() + float_4(5.f)) * baseRateBottom / float_4(32.f);
+            rate = voltsToNormal(bottomLFORate.getLeft(polyChunk) * params[RATE2_ATTEN_PARAM].getValue() + baseRateBottom, .01f, -10.f, 22.f, Ts);
             bottomPhase += rate;
             bottomPhase -= (bottomPhase >= 1.f) & 1.f;
 
@@ -135,3 +136,4 @@ struct TRSSPINWidget : ModuleWidget {
 };
 
 Model *modelTRSSPIN = createModel<TRSSPIN, TRSSPINWidget>("TRSSPIN");
+TRS_FOOTPRINT(TRSSPIN, 1024);
@@ -35,12 +35,27 @@ struct TRSTS : Module {
     int out1Channels = 1;
     int out2Channels = 1;
 
+    // the joins normal a lone L or R jack to both sides, set from which jacks are patched
+    StereoMatrix join1;
+    StereoMatrix join2;
+
+    dsp::ClockDivider patchDivider;
+
     TRSTS() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
         stereo1In.configure(&this->inputs[LR1_INPUT]);
         stereo1Out.configure(&this->outputs[LR1_OUTPUT]);
         stereo2In.configure(&this->inputs[LR2_INPUT]);
         stereo2Out.configure(&this->outputs[LR2_OUTPUT]);
+
+        patchDivider.setDivision(32);
+    }
+
+    /** Each side passes its own jack, or the other side's when only that one is patched. */
+    static void setJoin(StereoMatrix *join, bool left, bool right) {
+        float ownLeft = (left || !right) ? 1.f : 0.f;
+        float ownRight = (right || !left) ? 1.f : 0.f;
+        join->set(ownLeft, 1.f - ownLeft, 1.f - ownRight, ownRight);
     }
 
     void process(const ProcessArgs &args) override {
@@ -52,13 +67,15 @@ struct TRSTS : Module {
         outputs[R1_OUTPUT].setChannels(out1Channels);
         outputs[R2_OUTPUT].setChannels(out2Channels);
 
-        for (int polyChunk = 0; polyChunk < 2; polyChunk ++) {
+        if (patchDivider.process()) {
+            setJoin(&join1, inputs[L1_INPUT].isConnected(), inputs[R1_INPUT].isConnected());
+            setJoin(&join2, inputs[L2_INPUT].isConnected(), inputs[R2_INPUT].isConnected());
+        }
 
-            stereo1Out.setLeft(inputs[L1_INPUT].getNormalVoltageSimd<float_4>(inputs[R1_INPUT].getVoltageSimd<float_4>(4 * polyChunk), 4 * polyChunk), polyChunk);
-            stereo1Out.setRight(inputs[R1_INPUT].getNormalVoltageSimd<float_4>(inputs[L1_INPUT].getVoltageSimd<float_4>(4 * polyChunk), 4 * polyChunk), polyChunk);
+        join1.process(inputs[L1_INPUT].getVoltages(), inputs[R1_INPUT].getVoltages(), stereo1Out.output->getVoltages(), stereo1Out.output->getVoltages(8));
+        join2.process(inputs[L2_INPUT].getVoltages(), inputs[R2_INPUT].getVoltages(), stereo2Out.output->getVoltages(), stereo2Out.output->getVoltages(8));
 
-            stereo2Out.setLeft(inputs[L2_INPUT].getNormalVoltageSimd<float_4>(inputs[R2_INPUT].getVoltageSimd<float_4>(4 * polyChunk), 4 * polyChunk), polyChunk);
-            stereo2Out.setRight(inputs[R2_INPUT].getNormalVoltageSimd<float_4>(inputs[L2_INPUT].getVoltageSimd<float_4>(4 * polyChunk), 4 * polyChunk), polyChunk);
+        for (int polyChunk = 0; polyChunk < 2; polyChunk ++) {
 
             outputs[L1_OUTPUT].setVoltageSimd<float_4>(stereo1In.getLeft(polyChunk), 4 * polyChunk);
             outputs[R1_OUTPUT].setVoltageSimd<float_4>(stereo1In.getRight(polyChunk), 4 * polyChunk);
@@ -113,4 +130,5 @@ struct TRSTSWidget : ModuleWidget {
 };
 
 
-Model *modelTRSTS = createModel<TRSTS, TRSTSWidget>("TRSTS");
\ No newline at end of file
+Model *modelTRSTS = createModel<TRSTS, TRSTSWidget>("TRSTS");
+TRS_FOOTPRINT(TRSTS, 1024);
\ No newline at end of file
@@ -13,6 +13,9 @@ struct TRSTURN : Module {
         PAN_INPUT,
         BAL_INPUT,
         MERGE_INPUT,
+        PAN_CV_INPUT,
+        BAL_CV_INPUT,
+        MERGE_CV_INPUT,
         NUM_INPUTS
     };
     enum OutputIds {
@@ -34,6 +37,29 @@ struct TRSTURN : Module {
     StereoInHandler panIn;
     StereoOutHandler panOut;
 
+    StereoInHandler mergeCV;
+    StereoInHandler balCV;
+    StereoInHandler panCV;
+
+    StereoMatrix mergeMatrix;
+    StereoMatrix balMatrix;
+    StereoMatrix panMatrix;
+
+    // the knobs the unpatched matrices were last built from
+    float mergeKnob = -1.f;
+    float balKnob = -1.f;
+    float leftKnob = -1.f;
+    float rightKnob = -1.f;
+
+    typedef void (TRSTURN::*MatrixKernel)(void);
+
+    // picked by whether each CV input is patched
+    MatrixKernel updateMerge;
+    MatrixKernel updateBal;
+    MatrixKernel updatePan;
+
+    dsp::ClockDivider patchDivider;
+
 
     TRSTURN() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -51,38 +77,99 @@ struct TRSTURN : Module {
         panIn.configure(&inputs[PAN_INPUT]);
         panOut.configure(&outputs[PAN_OUTPUT]);
 
+        mergeCV.configure(&inputs[MERGE_CV_INPUT]);
+        balCV.configure(&inputs[BAL_CV_INPUT]);
+        panCV.configure(&inputs[PAN_CV_INPUT]);
+
+        patchDivider.setDivision(32);
+
+        updateMerge = &TRSTURN::updateMergeMatrix<false>;
+        updateBal = &TRSTURN::updateBalMatrix<false>;
+        updatePan = &TRSTURN::updatePanMatrix<false>;
+
     }
 
-    void process(const ProcessArgs &args) override {
+    void selectKernels(void) {
+        updateMerge = mergeCV.isConnected() ? &TRSTURN::updateMergeMatrix<true> : &TRSTURN::updateMergeMatrix<false>;
+        updateBal = balCV.isConnected() ? &TRSTURN::updateBalMatrix<true> : &TRSTURN::updateBalMatrix<false>;
+        updatePan = panCV.isConnected() ? &TRSTURN::updatePanMatrix<true> : &TRSTURN::updatePanMatrix<false>;
 
-        float_4 balance = float_4(params[BAL_PARAM].getValue());
-        float_4 merge = float_4(params[MERGE_PARAM].getValue());
-        float_4 leftPan = float_4(params[LEFT_PARAM].getValue());
-        float_4 rightPan = float_4(params[RIGHT_PARAM].getValue());
+        // a CV kernel leaves per voice coefficients behind, so the knob paths rebuild on their next call
+        mergeKnob = balKnob = leftKnob = rightKnob = -1.f;
+    }
 
+    /** Knob plus CV per voice, 10 V sweeps the whole range. */
+    static inline float_4 control(float knob, float_4 cv) {
+        return clamp(float_4(knob) + cv * float_4(0.1f), float_4(0.f), float_4(1.f));
+    }
+
+    template <bool CV>
+    void updateMergeMatrix(void) {
+        float knob = params[MERGE_PARAM].getValue();
+        if (!CV) {
+            if (knob != mergeKnob) {
+                mergeKnob = knob;
+                mergeMatrix.set(1.f - knob, knob, knob, 1.f - knob);
+            }
+            return;
+        }
         for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
+            float_4 merge = control(knob, mergeCV.getLeft(polyChunk));
+            float_4 keep = float_4(1.f) - merge;
+            mergeMatrix.setChunk(polyChunk, keep, merge, merge, keep);
+        }
+    }
+
+    template <bool CV>
+    void updateBalMatrix(void) {
+        float knob = params[BAL_PARAM].getValue();
+        if (!CV) {
+            if (knob != balKnob) {
+                balKnob = knob;
+                balMatrix.set(1.f - knob, 0.f, 0.f, knob);
+            }
+            return;
+        }
+        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
+            float_4 balance = control(knob, balCV.getLeft(polyChunk));
+            balMatrix.setChunk(polyChunk, float_4(1.f) - balance, float_4(0.f), float_4(0.f), balance);
+        }
+    }
+
+    /** The left voices of the CV move the left pan, the right voices the right pan. */
+    template <bool CV>
+    void updatePanMatrix(void) {
+        float left = params[LEFT_PARAM].getValue();
+        float right = params[RIGHT_PARAM].getValue();
+        if (!CV) {
+            if (left != leftKnob || right != rightKnob) {
+                leftKnob = left;
+                rightKnob = right;
+                panMatrix.set(1.f - left, 1.f - right, left, right);
+            }
+            return;
+        }
+        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
+            float_4 leftPan = control(left, panCV.getLeft(polyChunk));
+            float_4 rightPan = control(right, panCV.getRight(polyChunk));
+            panMatrix.setChunk(polyChunk, float_4(1.f) - leftPan, float_4(1.f) - rightPan, leftPan, rightPan);
+        }
+    }
 
-            float_4 left = mergeIn.getLeft(polyChunk);
-            float_4 right = mergeIn.getRight(polyChunk);
-            float_4 write = left * (float_4(1.f) - merge) + right * merge;
-            mergeOut.setLeft(write, polyChunk);
-            write = right * (float_4(1.f) - merge) + left * merge;
-            mergeOut.setRight(write, polyChunk);
-
-            left = balIn.getLeft(polyChunk);
-            right = balIn.getRight(polyChunk);
-            balOut.setLeft(left * (float_4(1.f) - balance), polyChunk);
-            balOut.setRight(right * balance, polyChunk);
-
-            left = panIn.getLeft(polyChunk);
-            right = panIn.getRight(polyChunk);
-            write = left * (float_4(1.f) - leftPan) + right * (float_4(1.f) - rightPan);
-            panOut.setLeft(write, polyChunk);
-            write = left * leftPan + right * rightPan;
-            panOut.setRight(write, polyChunk);
+    void process(const ProcessArgs &args) override {
 
+        if (patchDivider.process()) {
+            selectKernels();
         }
 
+        (this->*updateMerge)();
+        (this->*updateBal)();
+        (this->*updatePan)();
+
+        mergeMatrix.process(mergeIn.input->getVoltages(), mergeOut.output->getVoltages());
+        balMatrix.process(balIn.input->getVoltages(), balOut.output->getVoltages());
+        panMatrix.process(panIn.input->getVoltages(), panOut.output->getVoltages());
+
         outputs[MERGE_OUTPUT].setChannels(16);
         outputs[BAL_OUTPUT].setChannels(16);
         outputs[PAN_OUTPUT].setChannels(16);
@@ -109,6 +196,9 @@ struct TRSTURNWidget : ModuleWidget {
         addInput(createInputCentered<HexJack>(mm2px(Vec(8.952, 97.773)), module, TRSTURN::PAN_INPUT));
         addInput(createInputCentered<HexJack>(mm2px(Vec(9.039, 57.063)), module, TRSTURN::BAL_INPUT));
         addInput(createInputCentered<HexJack>(mm2px(Vec(8.954, 17.584)), module, TRSTURN::MERGE_INPUT));
+        addInput(createInputCentered<HexJack>(mm2px(Vec(15.35, 46.0)), module, TRSTURN::MERGE_CV_INPUT));
+        addInput(createInputCentered<HexJack>(mm2px(Vec(15.436, 85.8)), module, TRSTURN::BAL_CV_INPUT));
+        addInput(createInputCentered<HexJack>(mm2px(Vec(15.36, 104.6)), module, TRSTURN::PAN_CV_INPUT));
 
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(21.777, 97.771)), module, TRSTURN::PAN_OUTPUT));
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(21.864, 57.065)), module, TRSTURN::BAL_OUTPUT));
@@ -117,4 +207,5 @@ struct TRSTURNWidget : ModuleWidget {
 };
 
 
-Model *modelTRSTURN = createModel<TRSTURN, TRSTURNWidget>("TRSTURN");
\ No newline at end of file
+Model *modelTRSTURN = createModel<TRSTURN, TRSTURNWidget>("TRSTURN");
+TRS_FOOTPRINT(TRSTURN, 1024);
\ No newline at end of file
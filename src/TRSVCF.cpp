@@ -34,6 +34,13 @@ struct TRSVCF : Module {
     StereoOutHandler bpOut;
     StereoOutHandler hpOut;
 
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
+
+    VoiceActivity voices;
+
+    ModuleProfiler profiler;
+
     TRSVCF() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
         configParam(FREQ_PARAM, -5.f, 5.f, 0.f, "");
@@ -49,92 +56,308 @@ struct TRSVCF : Module {
         bpOut.configure(&outputs[BP_OUTPUT]);
         lpOut.configure(&outputs[LP_OUTPUT]);
 
+        flushDivider.setDivision(64);
+
+        patchDivider.setDivision(32);
+        selectKernels();
+
+        onSampleRateChange();
+
     }
 
-    ZDFSVF<float_4> filters[2][2];
-    UpsamplePow2<4, float_4> up[2][2];
-    DecimatePow2<4, float_4> downLP[2][2];
-    DecimatePow2<4, float_4> downBP[2][2];
-    DecimatePow2<4, float_4> downHP[2][2];
+    // one filter per voice pair, see voices.hpp
+    ZDFSVF<float_4> filters[VOICE_PAIRS];
+
+    struct VCFFrame {
+        float_4 freq[VOICE_PAIRS];
+        float_4 res[VOICE_PAIRS];
+        float_4 in[VOICE_PAIRS];
+        // the coefficients changed on this frame
+        bool moved;
+    };
+
+    struct VCFOutFrame {
+        float_4 lp[VOICE_PAIRS];
+        float_4 bp[VOICE_PAIRS];
+        float_4 hp[VOICE_PAIRS];
+    };
+
+    BlockBuffer<VCFFrame, VCFOutFrame> block;
+    // pairs that have to run over the block being gathered
+    bool blockAwake[VOICE_PAIRS] = {};
+    // pairs whose filter has missed a coefficient change while the block path left it asleep
+    bool blockStale[VOICE_PAIRS] = {true, true, true, true};
+
+    QualityChoice quality;
+    dsp::ClockDivider coefficientDivider;
+
+    // held between coefficient updates
+    float_4 freq[VOICE_PAIRS] = {};
+    float_4 res[VOICE_PAIRS] = {};
+
+    // set while every voice on both sides shares one cutoff and resonance
+    bool linked = false;
+
+    // specialised on which of the CV and NORM inputs are patched, an unpatched one is a constant 0V
+    bool (TRSVCF::*updateCoefficientsFor)(float Ts);
+    float_4 (TRSVCF::*readInputFor)(int pair, float_4 res);
 
-    float_4 workLP[4];
-    float_4 workBP[4];
-    float_4 workHP[4];   
+    dsp::ClockDivider patchDivider;
 
     void process(const ProcessArgs &args) override {
 
-        float_4 Ts = float_4(APP->engine->getSampleTime());
+        DenormalGuard denormalGuard;
+        TRS_PROFILE_FRAME(profiler);
+
+        float Ts = APP->engine->getSampleTime();
 
         outputs[HP_OUTPUT].setChannels(16);
         outputs[BP_OUTPUT].setChannels(16);
         outputs[LP_OUTPUT].setChannels(16);
 
-        for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
-
-            float_4 freql = clamp(expoCV.getLeft(polyChunk) + float_4(params[FREQ_PARAM].getValue()), float_4(-10.f), float_4(10.f));
-            freql = float_4(480.f) * (dsp::approxExp2_taylor5(freql + 10.f)/float_4(1024.f)) * Ts;
-            freql *= clamp((linCV.getLeft(polyChunk) / float_4(5.f)) + float_4(1.f), 0.1f, 2.f);
-            freql = clamp(freql, 0.f, .49f);
-
-            float_4 res = (resCV.getLeft(polyChunk) / float_4(10.f));
-            res += float_4(params[RES_PARAM].getValue());
-            res = clamp(res, 0.f, 1.f);
-            res = dsp::approxExp2_taylor5((float_4(1.f) - res) * float_4(8.f)) / float_4(256.f);
-            res = float_4(1.f) - res + float_4(1.f/256.f);
-
-            filters[0][polyChunk].setParams(freql, res);
-            float_4 in = signalIn.getLeft() + normIn.getLeft() * (float_4(1.f) - (res * float_4(.9f)));
-            // up[0][polyChunk].process(in);
-            // for (int i = 0; i < 4; i++) {
-            //     filters[0][polyChunk].process(up[0][polyChunk].output[i]);
-            //     workLP[i] = filters[0][polyChunk].lpOut;
-            //     workBP[i] = filters[0][polyChunk].bpOut;
-            //     workHP[i] = filters[0][polyChunk].hpOut;
-            // }
-
-            // hpOut.setLeft(downLP[0][polyChunk].process(workLP), polyChunk);
-            // bpOut.setLeft(downBP[0][polyChunk].process(workBP), polyChunk);
-            // lpOut.setLeft(downHP[0][polyChunk].process(workHP), polyChunk);
-
-            filters[0][polyChunk].process(in);
-
-            hpOut.setLeft(filters[0][polyChunk].hpOut, polyChunk);
-            bpOut.setLeft(filters[0][polyChunk].bpOut, polyChunk);
-            lpOut.setLeft(filters[0][polyChunk].lpOut, polyChunk);
-
-            float_4 freqr = clamp(expoCV.getRight(polyChunk) + float_4(params[FREQ_PARAM].getValue()), float_4(-10.f), float_4(10.f));
-            freqr = float_4(480.f) * (dsp::approxExp2_taylor5(freqr + 10.f)/float_4(1024.f)) * Ts;
-            freqr *= clamp((linCV.getRight(polyChunk) / float_4(5.f)) + float_4(1.f), 0.1f, 2.f);
-            freqr = clamp(freqr, 0.f, .49f);
-
-            res = (resCV.getRight(polyChunk) / float_4(10.f));
-            res += float_4(params[RES_PARAM].getValue());
-            res = clamp(res, 0.f, 1.f);
-            res = dsp::approxExp2_taylor5((float_4(1.f) - res) * float_4(8.f)) / float_4(256.f);
-            res = float_4(1.f) - res + float_4(1.f/256.f);
-
-            filters[1][polyChunk].setParams(freqr, res);
-            in = signalIn.getRight() + normIn.getRight() * (float_4(1.f) - (res * float_4(.9f)));
-            // up[1][polyChunk].process(in);
-            // for (int i = 0; i < 4; i++) {
-            //     filters[1][polyChunk].process(up[1][polyChunk].output[i]);
-            //     workLP[i] = filters[1][polyChunk].lpOut;
-            //     workBP[i] = filters[1][polyChunk].bpOut;
-            //     workHP[i] = filters[1][polyChunk].hpOut;
-            // }
-
-            // hpOut.setRight(downLP[1][polyChunk].process(workLP), polyChunk);
-            // bpOut.setRight(downBP[1][polyChunk].process(workBP), polyChunk);
-            // lpOut.setRight(downHP[1][polyChunk].process(workHP), polyChunk);
-
-            filters[1][polyChunk].process(in);
-
-            hpOut.setRight(filters[1][polyChunk].hpOut, polyChunk);
-            bpOut.setRight(filters[1][polyChunk].bpOut, polyChunk);
-            lpOut.setRight(filters[1][polyChunk].lpOut, polyChunk);
+        if (quality.update()) {
+            coefficientDivider.setDivision(qualityCoefficientDivision(quality.tier));
+        }
+        bool refresh = coefficientDivider.process();
+
+        if (patchDivider.process()) {
+            selectKernels();
+        }
+
+        if (block.update()) {
+            processBlock(Ts, refresh);
+            return;
+        }
+
+        bool moved = refresh && (this->*updateCoefficientsFor)(Ts);
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            bool wasAwake = voices.awake(pair);
+
+            float_4 in = (this->*readInputFor)(pair, res[pair]);
+
+            if (!voices.wake(pair, abs(in))) {
+                continue;
+            }
+
+            ZDFSVF<float_4> &filter = filters[pair];
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_FILTER);
+
+                // a pair that slept through a coefficient change picks it up as it wakes
+                if (moved || !wasAwake) {
+                    filter.setParams(freq[pair], res[pair]);
+                }
+
+                filter.process(in);
+            }
+
+            {
+                TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+
+                hpOut.setPair(filter.hpOut, pair);
+                bpOut.setPair(filter.bpOut, pair);
+                lpOut.setPair(filter.lpOut, pair);
+            }
+
+            float_4 outPeak = fmax(abs(filter.lpOut), fmax(abs(filter.bpOut), abs(filter.hpOut)));
+            if (voices.settle(pair, outPeak)) {
+                silencePair(pair);
+                clearFilter(pair);
+            }
+
+        }
+
+        // the filter state lives in starling-dsp, so it is judged by what comes out and cleared whole
+        if (flushDivider.process()) {
+            int seen = 0;
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                int pairSeen = countSubnormals(filters[pair].bpOut) + countSubnormals(filters[pair].lpOut);
+                if (pairSeen) {
+                    clearFilter(pair);
+                    filters[pair].setParams(freq[pair], res[pair]);
+                    blockStale[pair] = false;
+                }
+                seen += pairSeen;
+            }
+            denormals.record(seen);
+        }
+
+    }
+
+    void silencePair(int pair) {
+        hpOut.setPair(float_4(0.f), pair);
+        bpOut.setPair(float_4(0.f), pair);
+        lpOut.setPair(float_4(0.f), pair);
+    }
+
+    /** Drops a decayed pair's filter state, the coefficients go with it and are set again before it next runs. */
+    void clearFilter(int pair) {
+        filters[pair] = ZDFSVF<float_4>();
+        blockStale[pair] = true;
+    }
+
+    void selectKernels(void) {
+        typedef bool (TRSVCF::*Kernel)(float);
+        static const Kernel kernels[8] = {
+            &TRSVCF::updateCoefficients<false, false, false>,
+            &TRSVCF::updateCoefficients<true, false, false>,
+            &TRSVCF::updateCoefficients<false, true, false>,
+            &TRSVCF::updateCoefficients<true, true, false>,
+            &TRSVCF::updateCoefficients<false, false, true>,
+            &TRSVCF::updateCoefficients<true, false, true>,
+            &TRSVCF::updateCoefficients<false, true, true>,
+            &TRSVCF::updateCoefficients<true, true, true>
+        };
+        updateCoefficientsFor = kernels[linCV.isConnected() | (expoCV.isConnected() << 1) | (resCV.isConnected() << 2)];
+        readInputFor = normIn.isConnected() ? &TRSVCF::readInput<true> : &TRSVCF::readInput<false>;
+    }
+
+    /** Reads the cutoff and resonance CVs, returns true when the filters need new coefficients. */
+    template <bool LIN, bool EXP, bool RES>
+    bool updateCoefficients(float Ts) {
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_COEFFICIENTS);
+
+        // unpatched or mono CVs drive every voice on both sides alike, so work out one set and share it
+        if ((!LIN || linCV.uniform()) && (!EXP || expoCV.uniform()) && (!RES || resCV.uniform())) {
+            float sharedFreq, sharedRes;
+            coefficientsFor(LIN ? linCV.getLeft() : 0.f, EXP ? expoCV.getLeft() : 0.f, RES ? resCV.getLeft() : 0.f, Ts, &sharedFreq, &sharedRes);
+            if (linked && sharedFreq == freq[0][0] && sharedRes == res[0][0]) {
+                return false;
+            }
+            linked = true;
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                freq[pair] = float_4(sharedFreq);
+                res[pair] = float_4(sharedRes);
+            }
+            return true;
+        }
 
+        linked = false;
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+            coefficientsFor(LIN ? linCV.getPair(pair) : float_4(0.f), EXP ? expoCV.getPair(pair) : float_4(0.f),
+                RES ? resCV.getPair(pair) : float_4(0.f), Ts, &freq[pair], &res[pair]);
         }
+        return true;
+
+    }
 
+    /** Cutoff and resonance for one voice or one chunk of voices. */
+    template <typename T>
+    void coefficientsFor(T lin, T expo, T resVolts, float Ts, T *freq, T *res) {
+
+        T fm = clamp((lin / T(5.f)) + T(1.f), 0.1f, 2.f);
+        *freq = qualityVoltsToNormal(quality.tier, expo + T(params[FREQ_PARAM].getValue()), 480.f, -10.f, 10.f, Ts, fm);
+
+        T r = (resVolts / T(10.f));
+        r += T(params[RES_PARAM].getValue());
+        r = clamp(r, 0.f, 1.f);
+        r = dsp::approxExp2_taylor5((T(1.f) - r) * T(8.f)) / T(256.f);
+        *res = T(1.f) - r + T(1.f/256.f);
+
+    }
+
+    // each voice filters its own audio, the normalled input is tamed as the resonance comes up
+    template <bool NORM>
+    float_4 readInput(int pair, float_4 res) {
+        float_4 in = signalIn.getPair(pair);
+        if (NORM) {
+            in += normIn.getPair(pair) * (float_4(1.f) - (res * float_4(.9f)));
+        }
+        return in;
+    }
+
+    /** Block mode: the ports see the block computed one block ago, then each awake pair's filter runs over the next one. */
+    void processBlock(float Ts, bool refresh) {
+
+        VCFFrame &frame = block.input();
+        frame.moved = refresh && (this->*updateCoefficientsFor)(Ts);
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+            frame.freq[pair] = freq[pair];
+            frame.res[pair] = res[pair];
+            frame.in[pair] = (this->*readInputFor)(pair, res[pair]);
+            blockAwake[pair] |= voices.wake(pair, abs(frame.in[pair]));
+        }
+
+        {
+            TRS_PROFILE_SCOPE(profiler, PROFILE_PORTS);
+
+            const VCFOutFrame &out = block.output();
+            for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+                hpOut.setPair(out.hp[pair], pair);
+                bpOut.setPair(out.bp[pair], pair);
+                lpOut.setPair(out.lp[pair], pair);
+            }
+        }
+
+        if (!block.advance()) {
+            return;
+        }
+
+        TRS_PROFILE_SCOPE(profiler, PROFILE_FILTER);
+
+        for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+
+            if (!blockAwake[pair]) {
+                for (int t = 0; t < block.size; t++) {
+                    VCFOutFrame &out = block.out[t];
+                    out.lp[pair] = float_4(0.f);
+                    out.bp[pair] = float_4(0.f);
+                    out.hp[pair] = float_4(0.f);
+                }
+                blockStale[pair] = true;
+                continue;
+            }
+            blockAwake[pair] = false;
+
+            ZDFSVF<float_4> &filter = filters[pair];
+            float_4 outPeak = float_4(0.f);
+            for (int t = 0; t < block.size; t++) {
+                const VCFFrame &in = block.in[t];
+                // as in the per sample path, only on the frames the coefficients moved
+                if (in.moved || blockStale[pair]) {
+                    filter.setParams(in.freq[pair], in.res[pair]);
+                    blockStale[pair] = false;
+                }
+                filter.process(in.in[pair]);
+                VCFOutFrame &out = block.out[t];
+                out.lp[pair] = filter.lpOut;
+                out.bp[pair] = filter.bpOut;
+                out.hp[pair] = filter.hpOut;
+                outPeak = fmax(outPeak, fmax(abs(filter.lpOut), fmax(abs(filter.bpOut), abs(filter.hpOut))));
+            }
+            if (voices.settle(pair, outPeak, block.size)) {
+                clearFilter(pair);
+            }
+
+        }
+
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "blockSize", json_integer(block.requestedSize.read()));
+        json_object_set_new(rootJ, "quality", json_integer(quality.requested.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ) {
+            block.request(json_integer_value(blockSizeJ));
+        }
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            quality.requested.post(json_integer_value(qualityJ));
+        }
+    }
+
+    void onSampleRateChange() override {
+        // long enough for a resonant ring to die away
+        voices.setTail(.2f, APP->engine->getSampleRate());
     }
 };
 
@@ -162,7 +385,20 @@ struct TRSVCFWidget : ModuleWidget {
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(21.777, 99.501)), module, TRSVCF::BP_OUTPUT));
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(21.777, 113.501)), module, TRSVCF::LP_OUTPUT));
     }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSVCF *module = dynamic_cast<TRSVCF*>(this->module);
+        appendQualityMenu(menu, &module->quality);
+        appendBlockMenu(menu, &module->block);
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
+#ifdef TRS_PROFILE
+        appendProfileMenu(menu, &module->profiler, "TRSVCF");
+#endif
+    }
 };
 
 
-Model *modelTRSVCF = createModel<TRSVCF, TRSVCFWidget>("TRSVCF");
\ No newline at end of file
+Model *modelTRSVCF = createModel<TRSVCF, TRSVCFWidget>("TRSVCF");
+TRS_FOOTPRINT(TRSVCF, 2 * 1024);
\ No newline at end of file
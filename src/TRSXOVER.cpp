@@ -13,17 +13,63 @@ struct TRSXOVER : Module {
     enum OutputIds {
         HIGH_OUTPUT,
         LOW_OUTPUT,
+        MIDLO_OUTPUT,
+        MIDHI_OUTPUT,
         NUM_OUTPUTS
     };
     enum LightIds {
         NUM_LIGHTS
     };
 
-    JOSSVF<float_4> filters[2][2];
+    enum Modes {
+        CLASSIC_MODE,
+        LR_2_BAND_MODE,
+        LR_3_BAND_MODE,
+        LR_4_BAND_MODE,
+        NUM_MODES
+    };
+
+    // octaves between neighbouring splits in the Linkwitz-Riley modes, FREQ sets the lowest one
+    #define XOVER_SPLIT_SPACING 3.f
+
+    // FREQ at its bottom puts a split at 20 Hz, one time constant there is 1 / (2 pi 20 Hz) = 8 ms and the two
+    // cascaded sections of a Linkwitz-Riley split want about eight of them before the incoming mode is clean
+    #define XOVER_WARM_SECONDS .064f
+
+    // where runMode() puts each band
+    enum Bands {
+        LOW_BAND,
+        MIDLO_BAND,
+        MIDHI_BAND,
+        HIGH_BAND,
+        NUM_BANDS
+    };
+
+    /** Both kinds of crossover for both sides, one per mode slot so a mode change can warm up and crossfade. */
+    struct XoverEngine {
+        JOSSVF<float_4> filters[2][2];
+        LRCrossover<float_4> crossovers[2][2];
+    };
+
+    XoverEngine engines[2];
+
+    SVFCoefficients coefficients[LR_MAX_BANDS - 1];
+    float coefficientFreq = -1.f;
+    float coefficientSampleTime = 0.f;
+
+    ConfigMailbox<int> mode {CLASSIC_MODE};
+    SwitchCrossfade<int> modeFade {CLASSIC_MODE};
 
     StereoInHandler in;
     StereoOutHandler high;
     StereoOutHandler low;
+    StereoOutHandler midLow;
+    StereoOutHandler midHigh;
+
+    IdleDetector idle;
+
+    dsp::ClockDivider flushDivider;
+    DenormalStats denormals;
 
 
     TRSXOVER() {
@@ -33,29 +79,163 @@ struct TRSXOVER : Module {
         in.configure(&inputs[SIGNAL_INPUT]);
         high.configure(&outputs[HIGH_OUTPUT]);
         low.configure(&outputs[LOW_OUTPUT]);
+        midLow.configure(&outputs[MIDLO_OUTPUT]);
+        midHigh.configure(&outputs[MIDHI_OUTPUT]);
+
+        flushDivider.setDivision(64);
+
+        onSampleRateChange();
 
     }
 
     void process(const ProcessArgs &args) override {
 
+        DenormalGuard denormalGuard;
+
         outputs[HIGH_OUTPUT].setChannels(16);
         outputs[LOW_OUTPUT].setChannels(16);
+        outputs[MIDLO_OUTPUT].setChannels(16);
+        outputs[MIDHI_OUTPUT].setChannels(16);
+
+        if (!idle.wake(hmax(in.peak()))) {
+            return;
+        }
+
+        modeFade.request(mode.read());
+
+        updateCoefficients(args.sampleTime);
+
+        float_4 outPeak = float_4(0.f);
 
         for (int polyChunk = 0; polyChunk < 2; polyChunk ++) {
 
-            filters[0][polyChunk].process(params[FREQ_PARAM].getValue(), .75f, in.getLeft(polyChunk), 0.f, 0.f, 0.f);
-            filters[1][polyChunk].process(params[FREQ_PARAM].getValue(), .75f, in.getRight(polyChunk), 0.f, 0.f, 0.f);
+            float_4 signal[2] = {in.getLeft(polyChunk), in.getRight(polyChunk)};
+            float_4 bands[2][NUM_BANDS];
 
-            high.setLeft(filters[0][polyChunk].hpOut, polyChunk);
-            high.setRight(filters[1][polyChunk].hpOut, polyChunk);
+            runMode(modeFade.to, modeFade.current(), polyChunk, signal, bands);
 
-            low.setLeft(filters[0][polyChunk].lpOut, polyChunk);
-            low.setRight(filters[1][polyChunk].lpOut, polyChunk);
+            // the outgoing mode keeps running until the incoming one has warmed up and faded in
+            if (modeFade.switching) {
+                float_4 old[2][NUM_BANDS];
+                runMode(modeFade.from, modeFade.previous(), polyChunk, signal, old);
+                float_4 w = float_4(modeFade.weight());
+                for (int side = 0; side < 2; side++) {
+                    for (int b = 0; b < NUM_BANDS; b++) {
+                        bands[side][b] = old[side][b] + (bands[side][b] - old[side][b]) * w;
+                    }
+                }
+            }
 
+            low.setLeft(bands[0][LOW_BAND], polyChunk);
+            low.setRight(bands[1][LOW_BAND], polyChunk);
+            midLow.setLeft(bands[0][MIDLO_BAND], polyChunk);
+            midLow.setRight(bands[1][MIDLO_BAND], polyChunk);
+            midHigh.setLeft(bands[0][MIDHI_BAND], polyChunk);
+            midHigh.setRight(bands[1][MIDHI_BAND], polyChunk);
+            high.setLeft(bands[0][HIGH_BAND], polyChunk);
+            high.setRight(bands[1][HIGH_BAND], polyChunk);
+
+            for (int b = 0; b < NUM_BANDS; b++) {
+                outPeak = fmax(outPeak, abs(bands[0][b]));
+                outPeak = fmax(outPeak, abs(bands[1][b]));
+            }
+
+        }
+
+        modeFade.advance();
+
+        if (flushDivider.process()) {
+            int seen = 0;
+            for (int slot = 0; slot < 2; slot++) {
+                for (int side = 0; side < 2; side++) {
+                    for (int polyChunk = 0; polyChunk < 2; polyChunk++) {
+                        seen += engines[slot].crossovers[side][polyChunk].flushDenormals();
+                        // the classic filter's state is starling-dsp's, a decayed one is replaced whole
+                        JOSSVF<float_4> &filter = engines[slot].filters[side][polyChunk];
+                        int filterSeen = countSubnormals(filter.lpOut) + countSubnormals(filter.hpOut);
+                        if (filterSeen) {
+                            filter = JOSSVF<float_4>();
+                        }
+                        seen += filterSeen;
+                    }
+                }
+            }
+            denormals.record(seen);
+        }
 
+        if (idle.settle(hmax(outPeak))) {
+            silenceOutput(outputs[HIGH_OUTPUT]);
+            silenceOutput(outputs[LOW_OUTPUT]);
+            silenceOutput(outputs[MIDLO_OUTPUT]);
+            silenceOutput(outputs[MIDHI_OUTPUT]);
         }
 
     }
+
+    /** Runs one poly chunk of both sides through the engine in `slot` set up as `mode`. */
+    void runMode(int slot, int mode, int polyChunk, const float_4 signal[2], float_4 bands[2][NUM_BANDS]) {
+
+        XoverEngine &engine = engines[slot];
+
+        if (mode == CLASSIC_MODE) {
+            for (int side = 0; side < 2; side++) {
+                JOSSVF<float_4> &filter = engine.filters[side][polyChunk];
+                filter.process(params[FREQ_PARAM].getValue(), .75f, signal[side], 0.f, 0.f, 0.f);
+                bands[side][LOW_BAND] = filter.lpOut;
+                bands[side][MIDLO_BAND] = float_4(0.f);
+                bands[side][MIDHI_BAND] = float_4(0.f);
+                bands[side][HIGH_BAND] = filter.hpOut;
+            }
+            return;
+        }
+
+        int numBands = mode + 1;
+        for (int side = 0; side < 2; side++) {
+            LRCrossover<float_4> &crossover = engine.crossovers[side][polyChunk];
+            crossover.process(signal[side], numBands, coefficients);
+            // the top band always goes to HIGH, the ones between LOW and HIGH fill MID LO then MID HI
+            bands[side][LOW_BAND] = crossover.bands[0];
+            bands[side][MIDLO_BAND] = numBands > 2 ? crossover.bands[1] : float_4(0.f);
+            bands[side][MIDHI_BAND] = numBands > 3 ? crossover.bands[2] : float_4(0.f);
+            bands[side][HIGH_BAND] = crossover.bands[numBands - 1];
+        }
+
+    }
+
+    /** The splits only move with the knob, so they are rebuilt when it or the sample rate changes rather than every sample. */
+    void updateCoefficients(float sampleTime) {
+        float freq = params[FREQ_PARAM].getValue();
+        if (freq == coefficientFreq && sampleTime == coefficientSampleTime) {
+            return;
+        }
+        coefficientFreq = freq;
+        coefficientSampleTime = sampleTime;
+        // 20 Hz to 20 kHz over the knob, splits above the top of the range sit just under Nyquist
+        for (int s = 0; s < LR_MAX_BANDS - 1; s++) {
+            float volts = freq * 10.f + s * XOVER_SPLIT_SPACING;
+            coefficients[s].set(voltsToNormal(volts, 20.f, 0.f, 10.f + 2.f * XOVER_SPLIT_SPACING, sampleTime));
+        }
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "mode", json_integer(mode.read()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* modeJ = json_object_get(rootJ, "mode");
+        if (modeJ) {
+            // no snap, a preset loaded while running fades between the modes like a menu change
+            mode.post(clamp((int) json_integer_value(modeJ), 0, NUM_MODES - 1));
+        }
+    }
+
+    void onSampleRateChange() override {
+        float sampleRate = APP->engine->getSampleRate();
+        idle.setTail(.05f, sampleRate);
+        modeFade.warmSamples = std::max(SWITCH_WARM_SAMPLES, (int) (XOVER_WARM_SECONDS * sampleRate));
+    }
 };
 
 
@@ -73,8 +253,50 @@ struct TRSXOVERWidget : ModuleWidget {
 
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 99.501)), module, TRSXOVER::HIGH_OUTPUT));
         addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 113.498)), module, TRSXOVER::LOW_OUTPUT));
+        addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 57.5)), module, TRSXOVER::MIDHI_OUTPUT));
+        addOutput(createOutputCentered<HexJack>(mm2px(Vec(10.16, 71.5)), module, TRSXOVER::MIDLO_OUTPUT));
+    }
+
+    void appendContextMenu(Menu *menu) override {
+        TRSXOVER *module = dynamic_cast<TRSXOVER*>(this->module);
+
+        struct ModeHandler : MenuItem {
+            TRSXOVER *module;
+            int mode;
+            void onAction(const event::Action &e) override {
+                module->mode.post(mode);
+            }
+        };
+
+        struct ModeItem : MenuItem {
+            TRSXOVER *module;
+            Menu *createChildMenu() override {
+                Menu *menu = new Menu();
+                const std::string modes[] = {
+                    "Classic", "Linkwitz-Riley 2 Band", "Linkwitz-Riley 3 Band", "Linkwitz-Riley 4 Band"
+                };
+                for (int i = 0; i < (int) LENGTHOF(modes); i++) {
+                    ModeHandler *menuItem = createMenuItem<ModeHandler>(modes[i], CHECKMARK(module->mode.read() == i));
+                    menuItem->module = module;
+                    menuItem->mode = i;
+                    menu->addChild(menuItem);
+                }
+                return menu;
+            }
+        };
+
+        menu->addChild(new MenuEntry);
+        ModeItem *mode = createMenuItem<ModeItem>("Crossover Mode");
+        mode->module = module;
+        mode->rightText = RIGHT_ARROW;
+        menu->addChild(mode);
+
+#ifdef TRS_DENORMAL_STATS
+        appendDenormalMenu(menu, &module->denormals);
+#endif
     }
 };
 
 
-Model *modelTRSXOVER = createModel<TRSXOVER, TRSXOVERWidget>("TRSXOVER");
\ No newline at end of file
+Model *modelTRSXOVER = createModel<TRSXOVER, TRSXOVERWidget>("TRSXOVER");
+TRS_FOOTPRINT(TRSXOVER, 16 * 1024);
\ No newline at end of file
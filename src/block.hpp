@@ -0,0 +1,126 @@
+#pragma once
+
+#include "plugin.hpp"
+#include "config.hpp"
+
+// Opt in block processing for the heavier modules. Instead of running the DSP once per process() call,
+// a module gathers a block of input frames, runs each filter or oversampler over the whole block in one
+// tight loop so its state stays in registers, and plays the results back one block later. The cost is a
+// fixed latency of one block, reported in the context menu.
+
+#define MAX_BLOCK_SIZE 64
+
+/** What the block menu talks to. The frames are only allocated once block mode is first asked for,
+ *  on the UI thread, so a module left per sample carries none of them. */
+struct BlockSizeChoice {
+
+	/** Set from the UI, picked up by the audio thread at the top of the next process(). */
+	ConfigMailbox<int> requestedSize {0};
+
+	virtual ~BlockSizeChoice() {}
+
+	virtual void allocate(void) = 0;
+
+	/** Called from the menu and dataFromJson(), never from process(). */
+	void request(int size) {
+		if (size > 0) {
+			allocate();
+		}
+		requestedSize.post(size);
+	}
+
+};
+
+/** Double buffered frames, `IN` is what a module gathers each sample and `OUT` what it plays back. */
+template <typename IN, typename OUT = IN>
+struct BlockBuffer : BlockSizeChoice {
+
+	IN *in = NULL;
+	OUT *out = NULL;
+
+	/** 0 runs the module per sample as usual. */
+	int size = 0;
+	int pos = 0;
+
+	~BlockBuffer() {
+		delete[] in;
+		delete[] out;
+	}
+
+	void allocate(void) override {
+		if (!in) {
+			in = new IN[MAX_BLOCK_SIZE]();
+			out = new OUT[MAX_BLOCK_SIZE]();
+		}
+	}
+
+	/** Returns true while block mode is on, applying a size change from the menu first.
+	 *  The mailbox is posted after the frames are allocated, so a non zero size always finds them. */
+	bool update(void) {
+		int requested = requestedSize.read();
+		if (requested != size) {
+			size = in ? clamp(requested, 0, MAX_BLOCK_SIZE) : 0;
+			pos = 0;
+			if (out) {
+				std::memset((void *) out, 0, MAX_BLOCK_SIZE * sizeof(OUT));
+			}
+		}
+		return size > 0;
+	}
+
+	/** Where this sample's inputs go. */
+	IN &input(void) {
+		return in[pos];
+	}
+
+	/** What was computed for the input one block ago, read before advance(). */
+	const OUT &output(void) {
+		return out[pos];
+	}
+
+	/** Moves to the next sample, returns true once a block has been gathered and has to be run. */
+	bool advance(void) {
+		pos++;
+		if (pos == size) {
+			pos = 0;
+			return true;
+		}
+		return false;
+	}
+
+};
+
+inline void appendBlockMenu(Menu *menu, BlockSizeChoice *choice) {
+
+	struct BlockHandler : MenuItem {
+		BlockSizeChoice *choice;
+		int size;
+		void onAction(const event::Action &e) override {
+			choice->request(size);
+		}
+	};
+
+	struct BlockItem : MenuItem {
+		BlockSizeChoice *choice;
+		Menu *createChildMenu() override {
+			Menu *menu = new Menu();
+			const int sizes[] = {0, 16, 32, 64};
+			for (int i = 0; i < (int) LENGTHOF(sizes); i++) {
+				std::string text = sizes[i] ? string::f("%d samples, %.2f ms latency", sizes[i], 1000.f * sizes[i] * APP->engine->getSampleTime()) : "Off";
+				BlockHandler *menuItem = createMenuItem<BlockHandler>(text, CHECKMARK(choice->requestedSize.read() == sizes[i]));
+				menuItem->choice = choice;
+				menuItem->size = sizes[i];
+				menu->addChild(menuItem);
+			}
+			return menu;
+		}
+	};
+
+	menu->addChild(new MenuEntry);
+	BlockItem *block = createMenuItem<BlockItem>("Block Processing");
+	block->choice = choice;
+	int size = choice->requestedSize.read();
+	block->rightText = (size ? string::f("%d", size) : "Off") + " " + RIGHT_ARROW;
+	menu->addChild(block);
+
+}
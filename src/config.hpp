@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+
+// Configuration changes from the context menu. The UI thread posts a value into a ConfigMailbox and the
+// audio thread reads it at the top of process(), so neither side ever sees a torn or half applied setting.
+// Where the change swaps one DSP engine for another, SwitchCrossfade moves between them without a click:
+// the incoming engine first runs silently on the live input so its state is filled, then the two are
+// crossfaded. Both run only for the length of the switch, and nothing is allocated or reset in bulk.
+
+/** Samples the incoming engine runs silently before it is heard. */
+#define SWITCH_WARM_SAMPLES 256
+/** Samples of the linear crossfade that follows. */
+#define SWITCH_FADE_SAMPLES 512
+
+/** A setting written by the UI thread and read by the audio thread. */
+template <typename T>
+struct ConfigMailbox {
+
+	std::atomic<T> value;
+
+	ConfigMailbox(T initial) : value(initial) {}
+
+	void post(T newValue) {
+		value.store(newValue, std::memory_order_release);
+	}
+
+	T read(void) const {
+		return value.load(std::memory_order_acquire);
+	}
+
+};
+
+/** Two engine slots, the one being heard and the one being switched away from, each holding its configuration. */
+template <typename T>
+struct SwitchCrossfade {
+
+	T slots[2];
+	/** Slot being heard, or faded in while switching. */
+	int to = 0;
+	int from = 1;
+
+	bool switching = false;
+	int position = 0;
+
+	/** Engines whose state takes longer than SWITCH_WARM_SAMPLES to fill set their own warm-up. */
+	int warmSamples = SWITCH_WARM_SAMPLES;
+
+	SwitchCrossfade(T initial) {
+		slots[0] = initial;
+		slots[1] = initial;
+	}
+
+	/** Configuration of the slot being heard. */
+	T current(void) const {
+		return slots[to];
+	}
+
+	/** Configuration being faded out, only meaningful while switching. */
+	T previous(void) const {
+		return slots[from];
+	}
+
+	/** Jumps to `value` with no fade, for patch load before the module runs. */
+	void snap(T value) {
+		slots[to] = value;
+		switching = false;
+	}
+
+	/** Starts a switch when `wanted` differs from the current configuration. Returns true when one has just started,
+	 *  so the caller can prepare the engine in slot `to`. A change that arrives mid switch waits for it to finish. */
+	bool request(T wanted) {
+		if (switching || wanted == slots[to]) {
+			return false;
+		}
+		from = to;
+		to ^= 1;
+		slots[to] = wanted;
+		position = 0;
+		switching = true;
+		return true;
+	}
+
+	/** Gain of the incoming engine `offset` samples from now, the outgoing one gets the rest. */
+	float weight(int offset = 0) const {
+		if (!switching) {
+			return 1.f;
+		}
+		float t = (float) (position + offset - warmSamples) / SWITCH_FADE_SAMPLES;
+		return t < 0.f ? 0.f : (t > 1.f ? 1.f : t);
+	}
+
+	void advance(int samples = 1) {
+		if (switching) {
+			position += samples;
+			switching = position < warmSamples + SWITCH_FADE_SAMPLES;
+		}
+	}
+
+};
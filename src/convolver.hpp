@@ -0,0 +1,527 @@
+#pragma once
+
+#include "plugin.hpp"
+#include "wav.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <osdialog.h>
+#include <pffft.h>
+
+// Uniformly partitioned overlap save convolution. The impulse response is cut into CONV_BLOCK sample
+// partitions and each one is transformed once, at load time. Every channel transforms its input once per
+// block into a frequency domain delay line, and an output block is the sum of each past input spectrum
+// times its partition's spectrum, one pffft SIMD multiply accumulate per partition and one inverse
+// transform. The cost per sample is set by the partition count over the block length, not by the IR
+// length times the sample rate as with direct convolution, and the multiply accumulates for the next block
+// are spread across the samples of this one so no single sample carries the whole IR. Each channel's block
+// boundary is offset from the others', so the forward and inverse transforms of different voices never
+// land on the same sample.
+//
+// Loading, resampling and partitioning happen on a loader thread, which hands the finished engine to the
+// audio thread through an atomic pointer. The audio thread hands the old engine back the same way and the
+// UI thread frees it, so process() never allocates, frees or waits. A rate change only notes the new rate and
+// the UI thread starts the reload. The delay lines are the bulk of an engine, so only the first voice pair's
+// come with it and the UI thread allocates the others the first time their voices are played.
+
+/** Partition length, and the latency of the wet signal. */
+#define CONV_BLOCK 256
+#define CONV_FFT (2 * CONV_BLOCK)
+/** 8 voices on each side. */
+#define CONV_CHANNELS 16
+/** Voice pairs as in voices.hpp, channels 2p and 2p + 1 on the left and 8 higher on the right. */
+#define CONV_PAIRS 4
+/** Longer responses are cut, the delay lines for all 16 channels grow with the IR. */
+#define CONV_MAX_SECONDS 3.f
+
+struct ConvolutionChannel {
+	/** The previous block and the one coming in, the overlap save input window. */
+	float *window;
+	/** Frequency domain delay line, one input spectrum per partition, the newest at `head`. */
+	float *spectra;
+	/** The next block's output spectrum, built up a few partitions per sample. */
+	float *accumulator;
+	/** This block's output, read out while the next block's input comes in. */
+	float *output;
+	int head = 0;
+	/** Spectra written since the last reset, older slots are skipped rather than cleared. */
+	int filled = 0;
+	/** Next partition to accumulate. */
+	int next = 1;
+	/** Position in the channel's current block. */
+	int pos = 0;
+	/** Where `pos` starts after a reset, staggered across the channels. */
+	int phase = 0;
+};
+
+struct ConvolutionEngine {
+
+	std::string path;
+	float sampleRate = 0.f;
+	int partitions = 0;
+	/** Samples a voice takes to ring out, the response plus one block of latency. */
+	int tailSamples = 0;
+	/** Partitions each channel accumulates per sample, enough to finish within the block. */
+	int perSample = 0;
+
+	PFFFT_Setup *setup = NULL;
+	/** The responses and the transform buffers, in one SIMD aligned allocation. */
+	float *memory = NULL;
+	/** Partition spectra per side, the right side points at the left for a mono file. */
+	float *response[2];
+	float *work;
+	float *scratch;
+
+	ConvolutionChannel channels[CONV_CHANNELS];
+
+	/** Each voice pair's four delay lines, NULL until allocatePair() has run for it. */
+	std::atomic<float *> pairMemory[CONV_PAIRS];
+	/** Pairs the audio thread has asked for, one bit each, served by the UI thread. */
+	std::atomic<int> wanted {0};
+
+	ConvolutionEngine(int partitionCount, bool stereo) {
+		partitions = partitionCount;
+		perSample = (partitions - 1 + CONV_BLOCK - 1) / CONV_BLOCK;
+		setup = pffft_new_setup(CONV_FFT, PFFFT_REAL);
+
+		size_t responseSize = (size_t) partitions * CONV_FFT;
+		size_t total = (stereo ? 2 : 1) * responseSize + 2 * CONV_FFT;
+		memory = (float *) pffft_aligned_malloc(total * sizeof(float));
+		std::memset(memory, 0, total * sizeof(float));
+
+		float *p = memory;
+		response[0] = p;
+		p += responseSize;
+		response[1] = stereo ? p : response[0];
+		p += stereo ? responseSize : 0;
+		work = p;
+		p += CONV_FFT;
+		scratch = p;
+
+		for (int c = 0; c < CONV_CHANNELS; c++) {
+			channels[c].phase = c * CONV_BLOCK / CONV_CHANNELS;
+		}
+		for (int pair = 0; pair < CONV_PAIRS; pair++) {
+			pairMemory[pair].store(NULL, std::memory_order_relaxed);
+		}
+		// voice 0 of each side is what most patches play, it is ready as soon as the engine is
+		allocatePair(0);
+	}
+
+	~ConvolutionEngine() {
+		for (int pair = 0; pair < CONV_PAIRS; pair++) {
+			float *lines = pairMemory[pair].load(std::memory_order_acquire);
+			if (lines) {
+				pffft_aligned_free(lines);
+			}
+		}
+		pffft_aligned_free(memory);
+		pffft_destroy_setup(setup);
+	}
+
+	/** Not on the audio thread: gives `pair`'s four channels their delay lines, then publishes them. */
+	void allocatePair(int pair) {
+		if (pairMemory[pair].load(std::memory_order_acquire)) {
+			return;
+		}
+		size_t channelSize = (size_t) partitions * CONV_FFT + 2 * CONV_FFT + CONV_BLOCK;
+		float *lines = (float *) pffft_aligned_malloc(4 * channelSize * sizeof(float));
+		std::memset(lines, 0, 4 * channelSize * sizeof(float));
+
+		const int pairChannels[4] = {2 * pair, 2 * pair + 1, 8 + 2 * pair, 9 + 2 * pair};
+		float *p = lines;
+		for (int c : pairChannels) {
+			ConvolutionChannel &channel = channels[c];
+			channel.window = p;
+			channel.accumulator = p + CONV_FFT;
+			channel.output = p + 2 * CONV_FFT;
+			channel.spectra = p + 2 * CONV_FFT + CONV_BLOCK;
+			channel.pos = channel.phase;
+			p += channelSize;
+		}
+		pairMemory[pair].store(lines, std::memory_order_release);
+	}
+
+	/** Audio thread: true when `pair` has its delay lines, otherwise asks for them and returns false. */
+	inline bool claim(int pair) {
+		if (pairMemory[pair].load(std::memory_order_acquire)) {
+			return true;
+		}
+		wanted.fetch_or(1 << pair, std::memory_order_relaxed);
+		return false;
+	}
+
+	/** Not on the audio thread: allocates every pair, for hosts with no UI thread to serve claim(). */
+	void allocateAll(void) {
+		for (int pair = 0; pair < CONV_PAIRS; pair++) {
+			allocatePair(pair);
+		}
+	}
+
+	/** Not on the audio thread: allocates every pair claim() has been refused for. */
+	void allocateWanted(void) {
+		int pairs = wanted.exchange(0, std::memory_order_relaxed);
+		for (int pair = 0; pair < CONV_PAIRS; pair++) {
+			if (pairs & (1 << pair)) {
+				allocatePair(pair);
+			}
+		}
+	}
+
+	/** Forgets channel `c`'s history, for a voice that has just woken. Its pair has to have been claimed. */
+	void reset(int c) {
+		ConvolutionChannel &channel = channels[c];
+		std::memset(channel.window, 0, CONV_FFT * sizeof(float));
+		std::memset(channel.accumulator, 0, CONV_FFT * sizeof(float));
+		std::memset(channel.output, 0, CONV_BLOCK * sizeof(float));
+		channel.filled = 0;
+		channel.next = 1;
+		channel.pos = channel.phase;
+	}
+
+	/** Accumulates up to `count` of the older partitions into channel `c`'s next output block. */
+	inline void accumulate(int c, int count) {
+		ConvolutionChannel &channel = channels[c];
+		const float *h = response[c >= 8];
+		int last = std::min(channel.filled, partitions - 1);
+		for (; count > 0 && channel.next <= last; count--, channel.next++) {
+			// partition p meets the input from p - 1 blocks before the newest spectrum
+			int slot = (channel.head - channel.next + 1 + partitions) % partitions;
+			pffft_zconvolve_accumulate(setup, channel.spectra + slot * CONV_FFT, h + channel.next * CONV_FFT,
+				channel.accumulator, 1.f / CONV_FFT);
+		}
+	}
+
+	/** One sample into channel `c`, one out, CONV_BLOCK samples late. Left voices are channels 0-7, right 8-15.
+	 *  The channel's pair has to have been claimed. */
+	inline float process(int c, float in) {
+		ConvolutionChannel &channel = channels[c];
+		channel.window[CONV_BLOCK + channel.pos] = in;
+		accumulate(c, perSample);
+		float out = channel.output[channel.pos];
+		if (++channel.pos == CONV_BLOCK) {
+			channel.pos = 0;
+			finishBlock(c);
+		}
+		return out;
+	}
+
+	/** Transforms channel `c`'s finished input block, adds the first partition and produces the next output block. */
+	void finishBlock(int c) {
+		ConvolutionChannel &channel = channels[c];
+		accumulate(c, partitions);
+
+		channel.head = (channel.head + 1) % partitions;
+		float *spectrum = channel.spectra + channel.head * CONV_FFT;
+		pffft_transform(setup, channel.window, spectrum, work, PFFFT_FORWARD);
+		pffft_zconvolve_accumulate(setup, spectrum, response[c >= 8], channel.accumulator, 1.f / CONV_FFT);
+
+		// overlap save, only the second half of the circular result is the linear convolution
+		pffft_transform(setup, channel.accumulator, scratch, work, PFFFT_BACKWARD);
+		std::memcpy(channel.output, scratch + CONV_BLOCK, CONV_BLOCK * sizeof(float));
+		std::memcpy(channel.window, channel.window + CONV_BLOCK, CONV_BLOCK * sizeof(float));
+		std::memset(channel.accumulator, 0, CONV_FFT * sizeof(float));
+
+		channel.filled = std::min(channel.filled + 1, partitions);
+		channel.next = 1;
+	}
+
+	/** Reads the WAV file at `path`, resamples it to `rate` and transforms its partitions. Runs on the
+	 *  loader thread, returns NULL with `error` set when the file can't be used. */
+	static ConvolutionEngine *load(const std::string &path, float rate, std::string *error) {
+		std::vector<uint8_t> data;
+		FILE *file = std::fopen(path.c_str(), "rb");
+		if (file) {
+			std::fseek(file, 0, SEEK_END);
+			long size = std::ftell(file);
+			std::fseek(file, 0, SEEK_SET);
+			data.resize(size > 0 ? size : 0);
+			if (std::fread(data.data(), 1, data.size(), file) != data.size()) {
+				data.clear();
+			}
+			std::fclose(file);
+		}
+		WavInfo info;
+		if (data.empty() || !parseWav(data.data(), data.size(), &info)) {
+			*error = "Can't read " + system::getFilename(path);
+			return NULL;
+		}
+
+		bool stereo = info.channels > 1;
+		// cut to length at the file's own rate, so a long file isn't resampled only to be thrown away
+		size_t length = std::min(info.frames, (size_t) (CONV_MAX_SECONDS * info.sampleRate));
+		std::vector<dsp::Frame<2>> frames(length);
+		for (size_t i = 0; i < length; i++) {
+			const uint8_t *p = data.data() + info.dataOffset + i * info.bytesPerFrame();
+			frames[i].samples[0] = wavSample(p, info);
+			frames[i].samples[1] = stereo ? wavSample(p + info.bitsPerSample / 8, info) : frames[i].samples[0];
+		}
+		if (info.sampleRate != (int) rate) {
+			frames = resample(frames, info.sampleRate, (int) rate);
+		}
+
+		if (frames.empty()) {
+			*error = system::getFilename(path) + " is empty";
+			return NULL;
+		}
+
+		ConvolutionEngine *engine = build(frames, stereo, rate);
+		engine->path = path;
+		return engine;
+	}
+
+	/** Partitions and transforms a response already at `rate`, cut to CONV_MAX_SECONDS. `frames` must not be empty. */
+	static ConvolutionEngine *build(const std::vector<dsp::Frame<2>> &frames, bool stereo, float rate) {
+		size_t length = std::min(frames.size(), (size_t) (CONV_MAX_SECONDS * rate));
+
+		ConvolutionEngine *engine = new ConvolutionEngine((length + CONV_BLOCK - 1) / CONV_BLOCK, stereo);
+		engine->sampleRate = rate;
+		engine->tailSamples = length + CONV_BLOCK;
+
+		float *block = engine->scratch;
+		for (int side = 0; side < (stereo ? 2 : 1); side++) {
+			for (int p = 0; p < engine->partitions; p++) {
+				// each partition zero padded to the transform length, so the products don't wrap
+				std::memset(block, 0, CONV_FFT * sizeof(float));
+				for (int i = 0; i < CONV_BLOCK && p * CONV_BLOCK + i < (int) length; i++) {
+					block[i] = frames[p * CONV_BLOCK + i].samples[side];
+				}
+				pffft_transform(engine->setup, block, engine->response[side] + p * CONV_FFT, engine->work, PFFFT_FORWARD);
+			}
+		}
+		return engine;
+	}
+
+	static std::vector<dsp::Frame<2>> resample(std::vector<dsp::Frame<2>> &in, int from, int to) {
+		dsp::SampleRateConverter<2> converter;
+		converter.setQuality(10);
+		converter.setRates(from, to);
+		// zeros after the response push the converter's own delay out with it
+		in.resize(in.size() + 1024);
+		std::vector<dsp::Frame<2>> out((size_t) ((double) in.size() * to / from) + 1);
+		int inFrames = in.size();
+		int outFrames = out.size();
+		converter.process(in.data(), &inFrames, out.data(), &outFrames);
+		out.resize(outFrames);
+		return out;
+	}
+
+};
+
+/** Builds engines on its own thread and passes them across. Requests queue up behind a load in progress,
+ *  only the newest one is carried out, and nothing on the UI or audio thread ever waits for a load. */
+struct ConvolutionLoader {
+
+	/** A finished engine the audio thread has not picked up yet. */
+	std::atomic<ConvolutionEngine *> pending {NULL};
+	/** One the audio thread has let go of, freed on the UI thread. */
+	std::atomic<ConvolutionEngine *> retired {NULL};
+	/** The one the audio thread is running, the UI thread allocates the delay lines it asks for. */
+	std::atomic<ConvolutionEngine *> active {NULL};
+
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable wake;
+	/** Signalled each time a load finishes or fails. */
+	std::condition_variable done;
+	/** An engine rate reload() has seen and the UI thread has not acted on yet, 0 when there is none. */
+	std::atomic<float> reloadRate {0.f};
+
+	// guarded by `lock`
+	std::string path;
+	float rate = 0.f;
+	/** Counts requests, a load that finishes behind a newer one is dropped. */
+	int requested = 0;
+	int started = 0;
+	bool quit = false;
+	std::string error;
+	bool loading = false;
+
+	ConvolutionLoader() {
+		thread = std::thread([this]() {
+			run();
+		});
+	}
+
+	~ConvolutionLoader() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		wake.notify_one();
+		thread.join();
+		delete pending.exchange(NULL);
+		delete retired.exchange(NULL);
+	}
+
+	void run(void) {
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			wake.wait(guard, [this]() {
+				return quit || started != requested;
+			});
+			if (quit) {
+				return;
+			}
+			started = requested;
+			std::string loadPath = path;
+			float loadRate = rate;
+			guard.unlock();
+
+			std::string loadError;
+			ConvolutionEngine *engine = ConvolutionEngine::load(loadPath, loadRate, &loadError);
+
+			guard.lock();
+			if (started != requested) {
+				delete engine;
+				continue;
+			}
+			if (engine) {
+				// one the audio thread never saw can go straight away
+				delete pending.exchange(engine, std::memory_order_acq_rel);
+			}
+			loading = false;
+			error = loadError;
+			done.notify_all();
+		}
+	}
+
+	/** Loads `newPath` at `newRate` in the background, the current engine plays until it is ready. */
+	void request(const std::string &newPath, float newRate) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			path = newPath;
+			rate = newRate;
+			requested++;
+			loading = true;
+			error = "";
+		}
+		wake.notify_one();
+	}
+
+	/** Safe from onSampleRateChange(): notes the new engine rate, the next collect() loads the current file again
+	 *  when it has moved away from the rate the file was resampled for. */
+	void reload(float newRate) {
+		reloadRate.store(newRate, std::memory_order_relaxed);
+	}
+
+	void startReload(void) {
+		float newRate = reloadRate.exchange(0.f, std::memory_order_relaxed);
+		if (newRate == 0.f) {
+			return;
+		}
+		std::string current;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (path.empty() || rate == newRate) {
+				return;
+			}
+			current = path;
+		}
+		request(current, newRate);
+	}
+
+	std::string getPath(void) {
+		std::lock_guard<std::mutex> guard(lock);
+		return path;
+	}
+
+	/** Audio thread: returns the engine to use from now on. A new one is only taken once the one before it has been collected. */
+	inline ConvolutionEngine *swap(ConvolutionEngine *current) {
+		if (!pending.load(std::memory_order_acquire) || retired.load(std::memory_order_acquire)) {
+			return current;
+		}
+		ConvolutionEngine *next = pending.exchange(NULL, std::memory_order_acq_rel);
+		retired.store(current, std::memory_order_release);
+		active.store(next, std::memory_order_release);
+		return next;
+	}
+
+	/** UI thread: allocates the delay lines the running engine asked for and frees the engine the audio thread gave back.
+	 *  Only this thread frees engines, so the active one can't go away while its lines are being allocated. */
+	void collect(void) {
+		startReload();
+		ConvolutionEngine *engine = active.load(std::memory_order_acquire);
+		if (engine) {
+			engine->allocateWanted();
+		}
+		delete retired.exchange(NULL, std::memory_order_acq_rel);
+	}
+
+	/** For tools that run a module with no UI thread, never while it is processing. Waits for the load in
+	 *  progress and gives the engines every delay line up front, so the first samples are already wet. */
+	void finish(void) {
+		startReload();
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [this]() {
+				return !loading;
+			});
+		}
+		ConvolutionEngine *next = pending.load(std::memory_order_acquire);
+		if (next) {
+			next->allocateAll();
+		}
+		ConvolutionEngine *engine = active.load(std::memory_order_acquire);
+		if (engine) {
+			engine->allocateAll();
+		}
+		delete retired.exchange(NULL, std::memory_order_acq_rel);
+	}
+
+	/** Hands `engine` to the audio thread as if it had been loaded, for tools that build a response in memory.
+	 *  Never while the module is processing. */
+	void install(ConvolutionEngine *engine) {
+		engine->allocateAll();
+		delete retired.exchange(NULL, std::memory_order_acq_rel);
+		delete pending.exchange(engine, std::memory_order_acq_rel);
+	}
+
+	std::string status(void) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (loading) {
+			return "Loading " + system::getFilename(path);
+		}
+		if (!error.empty()) {
+			return error;
+		}
+		return path.empty() ? "No impulse response" : system::getFilename(path);
+	}
+
+};
+
+/** A module that owns a loader, so the tools can reach it without knowing the module's type. */
+struct ConvolutionHost {
+	virtual ~ConvolutionHost() {}
+	virtual ConvolutionLoader *convolutionLoader() = 0;
+};
+
+inline void appendConvolutionMenu(Menu *menu, ConvolutionLoader *loader) {
+
+	struct LoadItem : MenuItem {
+		ConvolutionLoader *loader;
+		void onAction(const event::Action &e) override {
+			std::string path = loader->getPath();
+			std::string dir = path.empty() ? asset::user("") : system::getDirectory(path);
+			osdialog_filters *filters = osdialog_filters_parse("WAV:wav,WAV");
+			char *chosen = osdialog_file(OSDIALOG_OPEN, dir.c_str(), NULL, filters);
+			osdialog_filters_free(filters);
+			if (chosen) {
+				loader->request(chosen, APP->engine->getSampleRate());
+				std::free(chosen);
+			}
+		}
+	};
+
+	menu->addChild(new MenuSeparator());
+	menu->addChild(createMenuLabel(loader->status()));
+	LoadItem *load = createMenuItem<LoadItem>("Load impulse response...");
+	load->loader = loader;
+	menu->addChild(load);
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+
+#include "plugin.hpp"
+
+using simd::float_4;
+
+// Recursive filters left running on silence decay toward subnormal floats, which some CPUs process
+// at a small fraction of normal speed. Modules hold a DenormalGuard for the length of process()
+// and zero their own decayed state at control rate with flushDenormal().
+
+/** State below this is treated as silence and zeroed, well above the subnormal range. */
+#define TRS_DENORMAL_FLOOR 1e-30f
+
+/** Sets flush to zero and denormals are zero for the life of the guard, restoring the previous mode after.
+ *  TRS_DENORMAL_STATS builds clear both instead, so state that would go subnormal without the guard does and
+ *  countSubnormals() sees it, the counts then show what the flush floor alone catches. */
+struct DenormalGuard {
+
+#if defined(__SSE__) || defined(__x86_64__)
+	#define _TRS_FTZ_DAZ 0x8040
+
+	unsigned int saved;
+	unsigned int mode;
+
+	DenormalGuard() {
+		saved = _mm_getcsr();
+#ifdef TRS_DENORMAL_STATS
+		mode = saved & ~_TRS_FTZ_DAZ;
+#else
+		mode = saved | _TRS_FTZ_DAZ;
+#endif
+		// the engine thread usually has these set already, skip the write when it does
+		if (mode != saved) {
+			_mm_setcsr(mode);
+		}
+	}
+
+	~DenormalGuard() {
+		if (mode != saved) {
+			_mm_setcsr(saved);
+		}
+	}
+#endif
+
+};
+
+inline bool isSubnormal(float x) {
+	uint32_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+	return ((bits & 0x7f800000) == 0) && ((bits & 0x007fffff) != 0);
+}
+
+/** Counts subnormal lanes, only evaluated in stats builds. */
+inline int countSubnormals(float x) {
+#ifdef TRS_DENORMAL_STATS
+	return isSubnormal(x);
+#else
+	return 0;
+#endif
+}
+
+inline int countSubnormals(float_4 x) {
+#ifdef TRS_DENORMAL_STATS
+	return isSubnormal(x[0]) + isSubnormal(x[1]) + isSubnormal(x[2]) + isSubnormal(x[3]);
+#else
+	return 0;
+#endif
+}
+
+/** Zeroes a state variable that has decayed below the floor, returns how many lanes were subnormal. */
+inline int flushDenormal(float &x) {
+	int seen = countSubnormals(x);
+	x = (std::fabs(x) < TRS_DENORMAL_FLOOR) ? 0.f : x;
+	return seen;
+}
+
+inline int flushDenormal(float_4 &x) {
+	int seen = countSubnormals(x);
+	x = ifelse(abs(x) < float_4(TRS_DENORMAL_FLOOR), float_4(0.f), x);
+	return seen;
+}
+
+/** Per module tally of subnormals seen at each flush, written by the audio thread and read by the context menu. */
+struct DenormalStats {
+
+	std::atomic<uint32_t> checks {0};
+	std::atomic<uint32_t> subnormals {0};
+
+	void record(int seen) {
+#ifdef TRS_DENORMAL_STATS
+		checks.fetch_add(1, std::memory_order_relaxed);
+		subnormals.fetch_add(seen, std::memory_order_relaxed);
+#endif
+	}
+
+};
+
+#ifdef TRS_DENORMAL_STATS
+inline void appendDenormalMenu(Menu *menu, DenormalStats *stats) {
+	uint32_t checks = stats->checks.load(std::memory_order_relaxed);
+	uint32_t subnormals = stats->subnormals.load(std::memory_order_relaxed);
+	menu->addChild(new MenuEntry);
+	menu->addChild(createMenuLabel(string::f("Subnormals seen: %u in %u checks", subnormals, checks)));
+}
+#endif
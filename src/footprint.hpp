@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+// Per model sizeof, reported by `build/trs-sizes`. The engine walks every module once a sample, so the
+// state a module carries inline competes with every other module in the patch for L2. Each model declares
+// a budget next to its createModel() line, with room for its DSP state over Rack's own Module base.
+
+struct ModuleFootprint {
+	const char *slug;
+	size_t size;
+	size_t budget;
+};
+
+inline std::vector<ModuleFootprint> &moduleFootprints(void) {
+	static std::vector<ModuleFootprint> footprints;
+	return footprints;
+}
+
+struct FootprintEntry {
+	FootprintEntry(const char *slug, size_t size, size_t budget) {
+		moduleFootprints().push_back({slug, size, budget});
+	}
+};
+
+#define TRS_FOOTPRINT(MODULE, BUDGET) \
+	static FootprintEntry MODULE##Footprint(#MODULE, sizeof(MODULE), BUDGET)
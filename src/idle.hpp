@@ -0,0 +1,65 @@
+#pragma once
+
+#include "plugin.hpp"
+
+using simd::float_4;
+
+// Stateful modules keep running their filters and oversamplers on silence unless told otherwise.
+// IdleDetector watches the input level and, once the inputs have gone quiet, waits for the
+// module's tail to decay before letting it sleep. A loud input wakes it on the same sample.
+
+/** Largest lane of a float_4. */
+inline float hmax(float_4 x) {
+	x = fmax(x, float_4(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(2, 3, 0, 1))));
+	x = fmax(x, float_4(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(1, 0, 3, 2))));
+	return x[0];
+}
+
+/** Zeroes all 16 channels of an output, used once when a module falls asleep. */
+inline void silenceOutput(Output &output) {
+	for (int c = 0; c < 16; c += 4) {
+		output.setVoltageSimd<float_4>(float_4(0.f), c);
+	}
+}
+
+struct IdleDetector {
+
+	/** Anything quieter than this (in volts) counts as silence, about -100 dB under a 10 Vpp signal. */
+	float threshold = 1e-4f;
+
+	/** How long the output has to stay below the threshold before the module sleeps. */
+	int tailSamples = 2048;
+
+	int quietCount = 0;
+	bool asleep = false;
+
+	void setTail(float seconds, float sampleRate) {
+		tailSamples = std::max(1, (int) (seconds * sampleRate));
+	}
+
+	/** Call with the loudest input every sample, returns true when the module needs to run its DSP. */
+	inline bool wake(float inputPeak) {
+		if (inputPeak > threshold) {
+			quietCount = 0;
+			asleep = false;
+			return true;
+		}
+		return !asleep;
+	}
+
+	/** Call with the loudest output after running the DSP, returns true on the sample the module falls asleep.
+	 *  Block paths pass the loudest output of the block and its length. */
+	inline bool settle(float outputPeak, int samples = 1) {
+		if (outputPeak > threshold) {
+			quietCount = 0;
+			return false;
+		}
+		quietCount += samples;
+		if (quietCount >= tailSamples) {
+			asleep = true;
+			return true;
+		}
+		return false;
+	}
+
+};
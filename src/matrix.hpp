@@ -0,0 +1,77 @@
+#pragma once
+
+#include "plugin.hpp"
+
+#ifdef __FMA__
+#include <immintrin.h>
+#endif
+
+using simd::float_4;
+
+// The 2x2 left / right mix behind the stereo utilities. Pan, balance, merge, mid / side and the join
+// normals are all the same matrix with different coefficients, so the modules set coefficients at control
+// rate and share one kernel for the loads, the multiply adds and the stores. Coefficients are per voice
+// lane, one set for each four voice chunk, so audio rate CV can set a different matrix for every voice.
+
+/** a * b + c, fused when the build targets FMA, otherwise the same two operations. */
+inline float_4 fmadd(float_4 a, float_4 b, float_4 c) {
+#ifdef __FMA__
+	return float_4(_mm_fmadd_ps(a.v, b.v, c.v));
+#else
+	return a * b + c;
+#endif
+}
+
+struct StereoMatrix {
+
+	// left out = ll * left + rl * right, right out = lr * left + rr * right
+	float_4 ll[2];
+	float_4 rl[2];
+	float_4 lr[2];
+	float_4 rr[2];
+
+	StereoMatrix() {
+		set(1.f, 0.f, 0.f, 1.f);
+	}
+
+	StereoMatrix(float newLL, float newRL, float newLR, float newRR) {
+		set(newLL, newRL, newLR, newRR);
+	}
+
+	/** The same matrix for every voice. */
+	void set(float newLL, float newRL, float newLR, float newRR) {
+		for (int chunk = 0; chunk < 2; chunk++) {
+			setChunk(chunk, float_4(newLL), float_4(newRL), float_4(newLR), float_4(newRR));
+		}
+	}
+
+	/** One matrix per voice of a four voice chunk. */
+	inline void setChunk(int chunk, float_4 newLL, float_4 newRL, float_4 newLR, float_4 newRR) {
+		chunk &= 1;
+		ll[chunk] = newLL;
+		rl[chunk] = newRL;
+		lr[chunk] = newLR;
+		rr[chunk] = newRR;
+	}
+
+	inline void apply(int chunk, float_4 left, float_4 right, float_4 *outLeft, float_4 *outRight) const {
+		*outLeft = fmadd(rl[chunk], right, ll[chunk] * left);
+		*outRight = fmadd(lr[chunk], left, rr[chunk] * right);
+	}
+
+	/** Eight voices from `left` and `right` into `outLeft` and `outRight`, which may be the two halves of one TRS port. */
+	inline void process(const float *left, const float *right, float *outLeft, float *outRight) const {
+		for (int chunk = 0; chunk < 2; chunk++) {
+			float_4 l, r;
+			apply(chunk, float_4::load(left + 4 * chunk), float_4::load(right + 4 * chunk), &l, &r);
+			l.store(outLeft + 4 * chunk);
+			r.store(outRight + 4 * chunk);
+		}
+	}
+
+	/** A whole TRS frame, left voices on channels 0-7 and right on 8-15. */
+	inline void process(const float *in, float *out) const {
+		process(in, in + 8, out, out + 8);
+	}
+
+};
@@ -1,7 +1,23 @@
 
 
+#pragma once
+
+#include "denormal.hpp"
+#include "config.hpp"
+
 using simd::float_4;
 
+namespace trs {
+
+/** Rounds `factor` down to a power of two between 1 and `maxFactor`. */
+inline int clampFactor(int factor, int maxFactor) {
+	int clamped = 1;
+	while (clamped * 2 <= factor && clamped * 2 <= maxFactor) {
+		clamped *= 2;
+	}
+	return clamped;
+}
+
 // From Fredrick Harris Multirate Signal Processing for Communication Systems
 // Original paper with AG Constantinides
 // https://www.researchgate.net/publication/259753999_Digital_Signal_Processing_with_Efficient_Polyphase_Recursive_All-pass_Filters
@@ -22,6 +38,15 @@ struct APPath1 {
 		a0 = T(coeff0);
 	}
 
+	void reset() {
+		d1 = T(0);
+		d2 = T(0);
+	}
+
+	int flushDenormals() {
+		return flushDenormal(d1) + flushDenormal(d2);
+	}
+
 	T d1 = T(0);
 	T d2 = T(0);
 
@@ -48,6 +73,16 @@ struct APPath2 {
 		a1 = T(coeff1);
 	}
 
+	void reset() {
+		d1 = T(0);
+		d2 = T(0);
+		d3 = T(0);
+	}
+
+	int flushDenormals() {
+		return flushDenormal(d1) + flushDenormal(d2) + flushDenormal(d3);
+	}
+
 	T d1 = T(0);
 	T d2 = T(0);
 	T d3 = T(0);
@@ -57,19 +92,12 @@ struct APPath2 {
 
 };
 
-/** Decimate by a factor of 32 with cascaded half band filters. */
+/** Decimate by a factor of up to 32 with cascaded half band filters. */
 template <int OVERSAMPLE, typename T = float>
 struct DecimatePow2 {
-	
-	T in32Buffer[32];
-
-	T in16Buffer[16];
-	
-	T in8Buffer[8];
-	
-	T in4Buffer[4];
 
-	T in2Buffer[2];
+	/** Factor actually run, a power of two up to OVERSAMPLE. */
+	int factor = OVERSAMPLE;
 
 	APPath2<T> from2to1Path1;
 	APPath2<T> from2to1Path2;
@@ -102,168 +130,74 @@ struct DecimatePow2 {
 		from32to16Path1.setCoefficients(0.11192);
 		from32to16Path2.setCoefficients(0.53976);
 
-		reset();
-
 	}
 
-	void reset() {
-		std::memset(in32Buffer, 0, sizeof(in32Buffer));
-		std::memset(in16Buffer, 0, sizeof(in16Buffer));
-		std::memset(in8Buffer, 0, sizeof(in8Buffer));
-		std::memset(in4Buffer, 0, sizeof(in4Buffer));
-		std::memset(in2Buffer, 0, sizeof(in2Buffer));
-	}
-
-	T process(T * in) {
-		if (OVERSAMPLE == 2) {
-			return process2x(in);
-		} else if (OVERSAMPLE == 4) {
-			return process4x(in);
-		} else if (OVERSAMPLE == 8) {
-			return process8x(in);
-		} else if (OVERSAMPLE == 16) {
-			return process16x(in);
-		}else if (OVERSAMPLE == 32) {
-			return process32x(in);
-		}  else {
-			return in[0];
+	/** Changing the factor reroutes the stages, so the state is cleared rather than carried across. */
+	void setFactor(int newFactor) {
+		newFactor = clampFactor(newFactor, OVERSAMPLE);
+		if (newFactor != factor) {
+			factor = newFactor;
+			reset();
 		}
 	}
 
-	/** `in` must be length 32 */
-	T process32x(T * in) {
-		
-		// copy in the data
-		std::memcpy(&in32Buffer[0], in, 32*sizeof(T));		
-
-		process32to16();
-		process16to8();
-		process8to4();
-		process4to2();
-		return process2to1();
-
-	}
-
-	/** `in` must be length 16 */
-	T process16x(T * in) {
-		
-		// copy in the data
-		std::memcpy(&in16Buffer[0], in, 16*sizeof(T));		
-
-		process16to8();
-		process8to4();
-		process4to2();
-		return process2to1();
-
-	}
-
-	/** `in` must be length 8 */
-	T process8x(T * in) {
-		
-		// copy in the data
-		std::memcpy(&in8Buffer[0], in, 8*sizeof(T));
-
-		process8to4();
-		process4to2();
-		return process2to1();
-
-	}
-
-	/** `in` must be length 4 */
-	T process4x(T * in) {
-		
-		// copy in the data
-		std::memcpy(&in4Buffer[0], in, 4*sizeof(T));
-
-		process4to2();
-		return process2to1();
-
+	void reset() {
+		from2to1Path1.reset(); from2to1Path2.reset();
+		from4to2Path1.reset(); from4to2Path2.reset();
+		from8to4Path1.reset(); from8to4Path2.reset();
+		from16to8Path1.reset(); from16to8Path2.reset();
+		from32to16Path1.reset(); from32to16Path2.reset();
 	}
 
-	/** `in` must be length 2 */
-	T process2x(T * in) {
-		
-		// copy in the data
-		std::memcpy(&in2Buffer[0], in, 2*sizeof(T));
-
-		return process2to1();
-
+	/** Zero any allpass state that has decayed below the floor, returns the number of subnormals found. */
+	int flushDenormals() {
+		return from2to1Path1.flushDenormals() + from2to1Path2.flushDenormals()
+			+ from4to2Path1.flushDenormals() + from4to2Path2.flushDenormals()
+			+ from8to4Path1.flushDenormals() + from8to4Path2.flushDenormals()
+			+ from16to8Path1.flushDenormals() + from16to8Path2.flushDenormals()
+			+ from32to16Path1.flushDenormals() + from32to16Path2.flushDenormals();
 	}
 
-	void inline process32to16(void) {
-
-		int writeIndex = 0;
-
-		// filter every other sample and write to the x8 buffer
-		for (int i = 0; i < 32; i += 2) {
-			
-			in16Buffer[writeIndex] = (from32to16Path1.process(in32Buffer[i + 1]) + from32to16Path2.process(in32Buffer[i])) * 0.5;
-			writeIndex++;
-
+	/** `in` holds `factor` samples and is used as the scratch space for every stage, so it comes back clobbered. */
+	T process(T * in) {
+		if (OVERSAMPLE >= 32 && factor >= 32) {
+			halve(in, 32, from32to16Path1, from32to16Path2);
 		}
-
-	}
-
-	void inline process16to8(void) {
-
-		int writeIndex = 0;
-
-		// filter every other sample and write to the x8 buffer
-		for (int i = 0; i < 16; i += 2) {
-			
-			in8Buffer[writeIndex] = (from16to8Path1.process(in16Buffer[i + 1]) + from16to8Path2.process(in16Buffer[i])) * 0.5;;
-			writeIndex++;
-
+		if (OVERSAMPLE >= 16 && factor >= 16) {
+			halve(in, 16, from16to8Path1, from16to8Path2);
 		}
-
-	}
-
-	void inline process8to4(void) {
-
-		in4Buffer[0] = (from8to4Path1.process(in8Buffer[1]) + from8to4Path2.process(in8Buffer[0])) * 0.5;
-
-		in4Buffer[1] = (from8to4Path1.process(in8Buffer[3]) + from8to4Path2.process(in8Buffer[2])) * 0.5;
-
-		in4Buffer[2] = (from8to4Path1.process(in8Buffer[5]) + from8to4Path2.process(in8Buffer[4])) * 0.5;
-
-		in4Buffer[3] = (from8to4Path1.process(in8Buffer[7]) + from8to4Path2.process(in8Buffer[6])) * 0.5;
-
+		if (OVERSAMPLE >= 8 && factor >= 8) {
+			halve(in, 8, from8to4Path1, from8to4Path2);
+		}
+		if (OVERSAMPLE >= 4 && factor >= 4) {
+			halve(in, 4, from4to2Path1, from4to2Path2);
+		}
+		if (OVERSAMPLE >= 2 && factor >= 2) {
+			return (from2to1Path1.process(in[1]) + from2to1Path2.process(in[0])) * T(0.5f);
+		}
+		return in[0];
 	}
 
-	void inline  process4to2(void) {
-
-		in2Buffer[0] = (from4to2Path1.process(in4Buffer[1]) + from4to2Path2.process(in4Buffer[0])) * 0.5;
-
-		in2Buffer[1] = (from4to2Path1.process(in4Buffer[3]) + from4to2Path2.process(in4Buffer[2])) * 0.5;
-
-
+	/** Filters every other sample down to `length / 2`, each write lands at or behind the pair it was read from. */
+	template <typename Path1, typename Path2>
+	static inline void halve(T * buffer, int length, Path1 &path1, Path2 &path2) {
+		for (int i = 0; i < length; i += 2) {
+			buffer[i >> 1] = (path1.process(buffer[i + 1]) + path2.process(buffer[i])) * T(0.5f);
+		}
 	}
 
-
-	T inline process2to1(void) {
-
-		return (from2to1Path1.process(in2Buffer[1]) + from2to1Path2.process(in2Buffer[0])) * 0.5;
-	}
-	
 };
 
 
 
 
-/** Upsample by a factor of 32 with cascaded half band filters. */
+/** Upsample by a factor of up to 32 with cascaded half band filters. */
 // This time weave alternating samples from the two allpass paths into the upsampled data stream
 template <int OVERSAMPLE, typename T = float>
 struct UpsamplePow2 {
-	
-	T out32Buffer[32];
-
-	T out16Buffer[16];
-	
-	T out8Buffer[8];
-	
-	T out4Buffer[4];
 
-	T out2Buffer[2];
+	/** Factor actually run, a power of two up to OVERSAMPLE. */
+	int factor = OVERSAMPLE;
 
 	APPath2<T> from1to2Path1;
 	APPath2<T> from1to2Path2;
@@ -276,8 +210,6 @@ struct UpsamplePow2 {
 	APPath1<T> from16to32Path1;
 	APPath1<T> from16to32Path2;
 
-	T * output;
-
 	UpsamplePow2() {
 
 		from1to2Path1.setCoefficients(0.0798664262025582, 0.5453236511825826);
@@ -295,139 +227,141 @@ struct UpsamplePow2 {
 		from16to32Path1.setCoefficients(0.11192);
 		from16to32Path2.setCoefficients(0.53976);
 
-		reset();
-
-		if (OVERSAMPLE == 2) {
-			output = out2Buffer;
-		} else if (OVERSAMPLE == 4) {
-			output = out4Buffer;
-		} else if (OVERSAMPLE == 8) {
-			output = out8Buffer;
-		} else if (OVERSAMPLE == 16) {
-			output = out16Buffer;
-		} else if (OVERSAMPLE == 32) {
-			output = out32Buffer;
-		}  else {
-			output = out2Buffer;
-		}
-
 	}
 
-	void reset() {
-		std::memset(out32Buffer, 0, sizeof(out32Buffer));
-		std::memset(out16Buffer, 0, sizeof(out16Buffer));
-		std::memset(out8Buffer, 0, sizeof(out8Buffer));
-		std::memset(out4Buffer, 0, sizeof(out4Buffer));
-		std::memset(out2Buffer, 0, sizeof(out2Buffer));
-	}
-
-	void process(T in) {
-		if (OVERSAMPLE == 2) {
-			process2x(in);
-		} else if (OVERSAMPLE == 4) {
-			process4x(in);
-		} else if (OVERSAMPLE == 8) {
-			process8x(in);
-		} else if (OVERSAMPLE == 16) {
-			process16x(in);
-		} else if (OVERSAMPLE == 32) {
-			process32x(in);
+	/** Changing the factor reroutes the stages, so the state is cleared rather than carried across. */
+	void setFactor(int newFactor) {
+		newFactor = clampFactor(newFactor, OVERSAMPLE);
+		if (newFactor != factor) {
+			factor = newFactor;
+			reset();
 		}
 	}
 
-	void process32x(T in) {
-
-		process1to2(in);
-		process2to4();
-		process4to8();
-		process8to16();
-		process16to32();
-
-	}
-
-	void process16x(T in) {
-
-		process1to2(in);
-		process2to4();
-		process4to8();
-		process8to16();
-
-	}
-
-	void process8x(T in) {
-
-		process1to2(in);
-		process2to4();
-		process4to8();
-
+	void reset() {
+		from1to2Path1.reset(); from1to2Path2.reset();
+		from2to4Path1.reset(); from2to4Path2.reset();
+		from4to8Path1.reset(); from4to8Path2.reset();
+		from8to16Path1.reset(); from8to16Path2.reset();
+		from16to32Path1.reset(); from16to32Path2.reset();
 	}
 
-	void process4x(T in) {
-		
-		process1to2(in);
-		process2to4();
-
+	/** Zero any allpass state that has decayed below the floor, returns the number of subnormals found. */
+	int flushDenormals() {
+		return from1to2Path1.flushDenormals() + from1to2Path2.flushDenormals()
+			+ from2to4Path1.flushDenormals() + from2to4Path2.flushDenormals()
+			+ from4to8Path1.flushDenormals() + from4to8Path2.flushDenormals()
+			+ from8to16Path1.flushDenormals() + from8to16Path2.flushDenormals()
+			+ from16to32Path1.flushDenormals() + from16to32Path2.flushDenormals();
 	}
 
-	void process2x(T in) {
-
-		process1to2(in);
-
+	/** Writes `factor` samples straight into the caller's `out`. */
+	void process(T in, T * out) {
+		// every stage lives in `out` itself, its samples `stride` apart, and the next stage fills in the gaps
+		out[0] = in;
+		if (OVERSAMPLE >= 2 && factor >= 2) {
+			interleave(out, factor, factor, from1to2Path1, from1to2Path2);
+		}
+		if (OVERSAMPLE >= 4 && factor >= 4) {
+			interleave(out, factor, factor / 2, from2to4Path1, from2to4Path2);
+		}
+		if (OVERSAMPLE >= 8 && factor >= 8) {
+			interleave(out, factor, factor / 4, from4to8Path1, from4to8Path2);
+		}
+		if (OVERSAMPLE >= 16 && factor >= 16) {
+			interleave(out, factor, factor / 8, from8to16Path1, from8to16Path2);
+		}
+		if (OVERSAMPLE >= 32 && factor >= 32) {
+			interleave(out, factor, factor / 16, from16to32Path1, from16to32Path2);
+		}
 	}
 
-	void inline process16to32(void) {
-
-		for (int i = 0; i < 32; i += 2) {
-			
-			out32Buffer[i] = from8to16Path2.process(out16Buffer[i >> 1]);
-			out32Buffer[i+1] = from8to16Path1.process(out16Buffer[i >> 1]);
-
+	/** Doubles the rate of the samples `stride` apart in the first `length` of `buffer`, in time order, writing the new ones half way between. */
+	template <typename Path1, typename Path2>
+	static inline void interleave(T * buffer, int length, int stride, Path1 &path1, Path2 &path2) {
+		int half = stride >> 1;
+		for (int i = 0; i < length; i += stride) {
+			T x = buffer[i];
+			buffer[i] = path2.process(x);
+			buffer[i + half] = path1.process(x);
 		}
-
 	}
 
-	void inline process8to16(void) {
-
-		for (int i = 0; i < 16; i += 2) {
-			
-			out16Buffer[i] = from8to16Path2.process(out8Buffer[i >> 1]);
-			out16Buffer[i+1] = from8to16Path1.process(out8Buffer[i >> 1]);
+};
 
-		}
+/** Internal rate the adaptive factors aim for: 4x at 44.1 kHz, 2x at 96 kHz, none at 192 kHz. */
+#define OVERSAMPLE_TARGET_RATE 176400.f
 
+/** Smallest power of two factor, up to `maxFactor`, that lifts `sampleRate` to at least `targetRate`. */
+inline int adaptiveFactor(float sampleRate, int maxFactor, float targetRate = OVERSAMPLE_TARGET_RATE) {
+	int factor = 1;
+	while (factor < maxFactor && sampleRate * factor < targetRate) {
+		factor *= 2;
 	}
+	return factor;
+}
 
-	void inline process4to8(void) {
+/** The factor a module runs at, picked from the engine rate unless the context menu fixes one. */
+struct OversampleChoice {
 
-		out8Buffer[0] = from4to8Path2.process(out4Buffer[0]);
-		out8Buffer[1] = from4to8Path1.process(out4Buffer[0]);
-		out8Buffer[2] = from4to8Path2.process(out4Buffer[1]);
-		out8Buffer[3] = from4to8Path1.process(out4Buffer[1]);
+	/** 0 follows the engine rate, otherwise a fixed factor. Set from the UI, picked up by update(). */
+	ConfigMailbox<int> requested {0};
+	int factor = 1;
+	int maxFactor;
 
-		out8Buffer[4] = from4to8Path2.process(out4Buffer[2]);
-		out8Buffer[5] = from4to8Path1.process(out4Buffer[2]);
-		out8Buffer[6] = from4to8Path2.process(out4Buffer[3]);
-		out8Buffer[7] = from4to8Path1.process(out4Buffer[3]);
+	int appliedRequest = -1;
+	float appliedRate = 0.f;
+	float targetRate = OVERSAMPLE_TARGET_RATE;
 
+	OversampleChoice(int maxFactor) : maxFactor(maxFactor) {}
 
+	/** Returns true when the factor has to be pushed to the module's oversamplers, called at the top of process(). */
+	bool update(float sampleRate, float newTargetRate = OVERSAMPLE_TARGET_RATE) {
+		int request = requested.read();
+		if (request == appliedRequest && sampleRate == appliedRate && newTargetRate == targetRate) {
+			return false;
+		}
+		appliedRequest = request;
+		appliedRate = sampleRate;
+		targetRate = newTargetRate;
+		factor = request ? clampFactor(request, maxFactor) : adaptiveFactor(sampleRate, maxFactor, targetRate);
+		return true;
 	}
 
-	void inline  process2to4(void) {
-
-		out4Buffer[0] = from2to4Path2.process(out2Buffer[0]);
-		out4Buffer[1] = from2to4Path1.process(out2Buffer[0]);
-		out4Buffer[2] = from2to4Path2.process(out2Buffer[1]);
-		out4Buffer[3] = from2to4Path1.process(out2Buffer[1]);
-
+};
 
-	}
+inline void appendOversampleMenu(Menu *menu, OversampleChoice *choice) {
 
+	struct OversampleHandler : MenuItem {
+		OversampleChoice *choice;
+		int requested;
+		void onAction(const event::Action &e) override {
+			choice->requested.post(requested);
+		}
+	};
+
+	struct OversampleItem : MenuItem {
+		OversampleChoice *choice;
+		Menu *createChildMenu() override {
+			Menu *menu = new Menu();
+			int automatic = adaptiveFactor(APP->engine->getSampleRate(), choice->maxFactor, choice->targetRate);
+			for (int requested = 0; requested <= choice->maxFactor; requested = requested ? requested * 2 : 1) {
+				std::string text = requested ? string::f("%dx", requested) : string::f("Auto (%dx at this rate)", automatic);
+				OversampleHandler *menuItem = createMenuItem<OversampleHandler>(text, CHECKMARK(choice->requested.read() == requested));
+				menuItem->choice = choice;
+				menuItem->requested = requested;
+				menu->addChild(menuItem);
+			}
+			return menu;
+		}
+	};
 
-	void inline process1to2(T in) {
+	menu->addChild(new MenuEntry);
+	OversampleItem *oversample = createMenuItem<OversampleItem>("Oversampling");
+	oversample->choice = choice;
+	oversample->rightText = string::f("%dx", choice->factor) + " " + RIGHT_ARROW;
+	menu->addChild(oversample);
 
-		out2Buffer[0] = from1to2Path2.process(in);
-		out2Buffer[1] = from1to2Path1.process(in);
+}
 
-	}
-	
-};
+} // namespace trs
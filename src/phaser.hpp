@@ -0,0 +1,100 @@
+#pragma once
+
+#include "plugin.hpp"
+#include "denormal.hpp"
+#include "pitch.hpp"
+
+// Zero delay feedback phaser, a cascade of trapezoidal one pole allpasses with feedback from the last
+// stage back to the first. Both sides of a stereo pair run packed in one float_4, left in lane 0 and
+// right in lane 1, so eight poles on a pair cost about what four did with one scalar phaser per side.
+// Every stage shares its side's cutoff, so one coefficient set serves the whole cascade, and the
+// feedback loop is solved in closed form from the stage states rather than per stage.
+
+/** Shared by every stage of a POLES stage cascade, one lane per side. */
+template <int POLES>
+struct PhaserCoefficients {
+
+	// one pole gain g / (1 + g)
+	float_4 G = float_4(0.f);
+	// a stage's allpass output is a * input + b * state
+	float_4 a = float_4(-1.f);
+	float_4 b = float_4(2.f);
+	// a^POLES, what the whole cascade does to its input
+	float_4 gain = float_4(1.f);
+	float_4 fb = float_4(0.f);
+	// 1 / (1 - fb * gain), the feedback loop solved for the cascade's output
+	float_4 loop = float_4(1.f);
+
+	float_4 normal = float_4(-1.f);
+	float feedback = -1.f;
+
+	/** Rebuilds only when the cutoffs or the feedback have moved since the last call. */
+	void set(float_4 newNormal, float newFeedback) {
+		if (newFeedback == feedback && movemask(newNormal != normal) == 0) {
+			return;
+		}
+		normal = newNormal;
+		feedback = newFeedback;
+
+		float_4 g = normalToG(normal);
+		G = g / (float_4(1.f) + g);
+		a = float_4(2.f) * G - float_4(1.f);
+		b = float_4(2.f) * (float_4(1.f) - G);
+		gain = a;
+		for (int p = 1; p < POLES; p *= 2) {
+			gain *= gain;
+		}
+		fb = float_4(feedback);
+		loop = float_4(1.f) / (float_4(1.f) - fb * gain);
+	}
+
+};
+
+/** POLES has to be a power of two. */
+template <int POLES>
+struct StereoPhaser {
+
+	float_4 state[POLES] = {};
+
+	PhaserCoefficients<POLES> coefficients;
+
+	void setParams(float normalL, float normalR, float feedback) {
+		coefficients.set(float_4(normalL, normalR, 0.f, 0.f), feedback);
+	}
+
+	/** `in` holds the left sample in lane 0 and the right in lane 1, the phased pair comes back the same way. */
+	inline float_4 process(float_4 in) {
+		const PhaserCoefficients<POLES> &c = coefficients;
+
+		// what the states alone put on the output, the cascade's response to its input is c.gain on top
+		float_4 fromState = float_4(0.f);
+		for (int p = 0; p < POLES; p++) {
+			fromState = c.a * fromState + c.b * state[p];
+		}
+		float_4 out = (c.gain * in + fromState) * c.loop;
+
+		float_4 x = in + c.fb * out;
+		for (int p = 0; p < POLES; p++) {
+			float_4 v = c.G * (x - state[p]);
+			float_4 lp = v + state[p];
+			state[p] = lp + v;
+			x = lp + lp - x;
+		}
+		return x;
+	}
+
+	void reset() {
+		for (int p = 0; p < POLES; p++) {
+			state[p] = float_4(0.f);
+		}
+	}
+
+	int flushDenormals() {
+		int seen = 0;
+		for (int p = 0; p < POLES; p++) {
+			seen += flushDenormal(state[p]);
+		}
+		return seen;
+	}
+
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "plugin.hpp"
+
+using simd::float_4;
+
+// V/oct CV to the numbers the filters, phasers, LFOs and delay lines actually run on.
+// The kernels are templated on the sample type so float and float_4 voices share one implementation,
+// and take an accuracy tier so tracking can be traded against cost here instead of in every module.
+
+enum PitchAccuracy {
+	// taylor exp2, Padé [3/2] prewarp, within 1% of tan up to a quarter of the sample rate
+	PITCH_ECO,
+	// taylor exp2, Padé [5/4] prewarp, within 1% of tan right up to PITCH_MAX_NORMAL
+	PITCH_STANDARD,
+	// library exp and sin/cos, for reference and offline use
+	PITCH_HIGH
+};
+
+/** Highest normalised frequency handed to a filter, just under Nyquist. */
+#define PITCH_MAX_NORMAL .49f
+
+inline float exactExp2(float x) {
+	return std::exp2(x);
+}
+
+inline float_4 exactExp2(float_4 x) {
+	return simd::exp(x * float_4(M_LN2));
+}
+
+inline float exactTan(float x) {
+	return std::tan(x);
+}
+
+inline float_4 exactTan(float_4 x) {
+	return simd::sin(x) / simd::cos(x);
+}
+
+template <int ACCURACY, typename T>
+inline T pitchExp2(T x) {
+	if (ACCURACY == PITCH_HIGH) {
+		return exactExp2(x);
+	}
+	return dsp::approxExp2_taylor5(x);
+}
+
+/** `baseHz` at 0V, one octave per volt, with the CV held to [minVolts, maxVolts].
+ *  The exponent is lifted by -minVolts so the Taylor series only ever sees positive arguments. */
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T voltsToHz(T volts, float baseHz, float minVolts, float maxVolts) {
+	volts = clamp(volts, T(minVolts), T(maxVolts));
+	return T(baseHz) * (pitchExp2<ACCURACY>(volts - T(minVolts)) / T(std::exp2(-minVolts)));
+}
+
+/** Cycles per sample, `fm` scales the frequency linearly before it is held under Nyquist. */
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T voltsToNormal(T volts, float baseHz, float minVolts, float maxVolts, float sampleTime, T fm = T(1.f)) {
+	T freq = voltsToHz<ACCURACY>(volts, baseHz, minVolts, maxVolts) * T(sampleTime) * fm;
+	return clamp(freq, T(0.f), T(PITCH_MAX_NORMAL));
+}
+
+/** Prewarped integrator gain g = tan(pi * normal) for the zero delay feedback filters. */
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T normalToG(T normal) {
+	T x = T(M_PI) * normal;
+	if (ACCURACY == PITCH_HIGH) {
+		return exactTan(x);
+	}
+	T x2 = x * x;
+	if (ACCURACY == PITCH_ECO) {
+		return x * (T(15.f) - x2) / (T(15.f) - T(6.f) * x2);
+	}
+	return x * (T(945.f) - T(105.f) * x2 + x2 * x2) / (T(945.f) - T(420.f) * x2 + T(15.f) * x2 * x2);
+}
+
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T voltsToG(T volts, float baseHz, float minVolts, float maxVolts, float sampleTime, T fm = T(1.f)) {
+	return normalToG<ACCURACY>(voltsToNormal<ACCURACY>(volts, baseHz, minVolts, maxVolts, sampleTime, fm));
+}
+
+/** Bucket brigade clock in Hz, `octaves` of sweep over a 0 to 1 time control. BBD<> takes the clock in Hz. */
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T timeToClock(T time, float baseHz, float octaves) {
+	return T(baseHz) * pitchExp2<ACCURACY>(time * T(octaves));
+}
+
+/** Seconds between clock ticks, for code that steps the line itself. */
+template <int ACCURACY = PITCH_STANDARD, typename T>
+inline T timeToClockPeriod(T time, float baseHz, float octaves) {
+	return T(1.f / baseHz) * pitchExp2<ACCURACY>(time * T(-octaves));
+}
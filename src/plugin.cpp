@@ -1,12 +1,17 @@
 #include "plugin.hpp"
+#include "quality.hpp"
 
 
 Plugin *pluginInstance;
 
+std::atomic<int> globalQuality {QUALITY_STANDARD};
+
 
 void init(Plugin *p) {
     pluginInstance = p;
 
+    loadQualitySettings();
+
     // Add modules here
     p->addModel(modelTRSTURN);
     p->addModel(modelTRSSPIN);
@@ -23,6 +28,8 @@ void init(Plugin *p) {
     p->addModel(modelTRSXOVER);
     p->addModel(modelTRSPRE);
     p->addModel(modelTRSMULTMETER);
+    p->addModel(modelTRSCHAIN);
+    p->addModel(modelTRSCONV);
 
     // Any other plugin initialization may go here.
     // As an alternative, consider lazy-loading assets and lookup tables when your module is created to reduce startup times of Rack.
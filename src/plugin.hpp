@@ -1,3 +1,5 @@
+#pragma once
+
 #include <rack.hpp>
 
 
@@ -21,4 +23,6 @@ extern Model *modelTRSBBD;
 extern Model *modelTRSPEAK;
 extern Model *modelTRSXOVER;
 extern Model *modelTRSPRE;
-extern Model *modelTRSMULTMETER;
\ No newline at end of file
+extern Model *modelTRSMULTMETER;
+extern Model *modelTRSCHAIN;
+extern Model *modelTRSCONV;
\ No newline at end of file
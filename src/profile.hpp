@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+
+#include "plugin.hpp"
+
+// Per stage timing inside process(), only compiled in with `make TRS_PROFILE=1`.
+// A module keeps a ModuleProfiler, calls TRS_PROFILE_FRAME() at the top of process() and wraps each
+// stage in a block opened with TRS_PROFILE_SCOPE(). One frame in PROFILE_SAMPLE_INTERVAL is timed,
+// the cost of a stage over that whole frame goes into a log2 histogram for the context menu or a JSON dump.
+
+enum ProfileStage {
+	PROFILE_COEFFICIENTS,
+	PROFILE_UPSAMPLE,
+	PROFILE_NONLINEARITY,
+	PROFILE_DECIMATE,
+	PROFILE_FILTER,
+	PROFILE_PORTS,
+	PROFILE_LIGHTS,
+	NUM_PROFILE_STAGES
+};
+
+#ifdef TRS_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRS_PROFILE_UNITS "cycles"
+inline uint64_t profileClock(void) {
+	return __rdtsc();
+}
+#else
+#include <chrono>
+#define TRS_PROFILE_UNITS "ns"
+inline uint64_t profileClock(void) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define PROFILE_SAMPLE_INTERVAL 16
+
+/** Four buckets per octave, bucket `i` starts at `bucketFloor(i)`. */
+struct ProfileHistogram {
+
+	static const int NUM_BUCKETS = 128;
+
+	std::atomic<uint32_t> counts[NUM_BUCKETS];
+	std::atomic<uint32_t> frames;
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> max;
+
+	ProfileHistogram() {
+		reset();
+	}
+
+	void reset(void) {
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			counts[i].store(0, std::memory_order_relaxed);
+		}
+		frames.store(0, std::memory_order_relaxed);
+		total.store(0, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+	}
+
+	static int bucket(uint64_t ticks) {
+		if (ticks < 4) {
+			return (int) ticks;
+		}
+		int octave = 63 - __builtin_clzll(ticks);
+		int sub = (int) (ticks >> (octave - 2)) & 3;
+		return std::min(octave * 4 + sub, NUM_BUCKETS - 1);
+	}
+
+	static uint64_t bucketFloor(int index) {
+		if (index < 4) {
+			return index;
+		}
+		return (uint64_t) (4 + (index & 3)) << ((index >> 2) - 2);
+	}
+
+	void add(uint64_t ticks) {
+		counts[bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+		frames.fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(ticks, std::memory_order_relaxed);
+		if (ticks > max.load(std::memory_order_relaxed)) {
+			max.store(ticks, std::memory_order_relaxed);
+		}
+	}
+
+	/** Floor of the bucket holding the `fraction` quantile. */
+	uint64_t percentile(float fraction) const {
+		uint32_t n = frames.load(std::memory_order_relaxed);
+		uint64_t target = (uint64_t) (fraction * n);
+		uint64_t seen = 0;
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen > target) {
+				return bucketFloor(i);
+			}
+		}
+		return max.load(std::memory_order_relaxed);
+	}
+
+	uint64_t mean(void) const {
+		uint32_t n = frames.load(std::memory_order_relaxed);
+		return n ? total.load(std::memory_order_relaxed) / n : 0;
+	}
+
+};
+
+struct ModuleProfiler {
+
+	ProfileHistogram stages[NUM_PROFILE_STAGES];
+	uint64_t pending[NUM_PROFILE_STAGES] = {};
+	bool used[NUM_PROFILE_STAGES] = {};
+
+	int countdown = 0;
+	bool sampling = false;
+
+	/** Hands the previous timed frame to the histograms and decides whether to time this one. */
+	void frame(void) {
+		if (sampling) {
+			for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+				if (used[i]) {
+					stages[i].add(pending[i]);
+				}
+				pending[i] = 0;
+				used[i] = false;
+			}
+		}
+		sampling = (countdown == 0);
+		countdown = sampling ? PROFILE_SAMPLE_INTERVAL - 1 : countdown - 1;
+	}
+
+	void reset(void) {
+		for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+			stages[i].reset();
+		}
+	}
+
+	json_t *toJson(void) const;
+
+	void dump(std::string slug) const;
+
+};
+
+struct ProfileScope {
+
+	ModuleProfiler *profiler;
+	int stage;
+	uint64_t start;
+
+	ProfileScope(ModuleProfiler &p, int s) {
+		profiler = p.sampling ? &p : NULL;
+		stage = s;
+		if (profiler) {
+			start = profileClock();
+		}
+	}
+
+	~ProfileScope() {
+		if (profiler) {
+			profiler->pending[stage] += profileClock() - start;
+			profiler->used[stage] = true;
+		}
+	}
+
+};
+
+static const char * const profileStageNames[NUM_PROFILE_STAGES] = {
+	"Coefficients", "Upsample", "Nonlinearity", "Decimate", "Filter", "Port I/O", "Lights"
+};
+
+inline json_t *ModuleProfiler::toJson(void) const {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "units", json_string(TRS_PROFILE_UNITS));
+	json_object_set_new(rootJ, "sampleInterval", json_integer(PROFILE_SAMPLE_INTERVAL));
+	json_t *stagesJ = json_object();
+	for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+		const ProfileHistogram &h = stages[i];
+		if (!h.frames.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		json_t *stageJ = json_object();
+		json_object_set_new(stageJ, "frames", json_integer(h.frames.load(std::memory_order_relaxed)));
+		json_object_set_new(stageJ, "mean", json_integer(h.mean()));
+		json_object_set_new(stageJ, "p50", json_integer(h.percentile(.5f)));
+		json_object_set_new(stageJ, "p99", json_integer(h.percentile(.99f)));
+		json_object_set_new(stageJ, "max", json_integer(h.max.load(std::memory_order_relaxed)));
+		json_t *bucketsJ = json_array();
+		for (int b = 0; b < ProfileHistogram::NUM_BUCKETS; b++) {
+			uint32_t count = h.counts[b].load(std::memory_order_relaxed);
+			if (count) {
+				json_t *bucketJ = json_array();
+				json_array_append_new(bucketJ, json_integer(ProfileHistogram::bucketFloor(b)));
+				json_array_append_new(bucketJ, json_integer(count));
+				json_array_append_new(bucketsJ, bucketJ);
+			}
+		}
+		json_object_set_new(stageJ, "histogram", bucketsJ);
+		json_object_set_new(stagesJ, profileStageNames[i], stageJ);
+	}
+	json_object_set_new(rootJ, "stages", stagesJ);
+	return rootJ;
+}
+
+inline void ModuleProfiler::dump(std::string slug) const {
+	std::string path = asset::user("TRS-profile-" + slug + ".json");
+	json_t *rootJ = toJson();
+	if (json_dump_file(rootJ, path.c_str(), JSON_INDENT(2)) == 0) {
+		INFO("Wrote TRS profile to %s", path.c_str());
+	} else {
+		WARN("Could not write TRS profile to %s", path.c_str());
+	}
+	json_decref(rootJ);
+}
+
+inline void appendProfileMenu(Menu *menu, ModuleProfiler *profiler, std::string slug) {
+
+	struct DumpItem : MenuItem {
+		ModuleProfiler *profiler;
+		std::string slug;
+		void onAction(const event::Action &e) override {
+			profiler->dump(slug);
+		}
+	};
+
+	struct ResetItem : MenuItem {
+		ModuleProfiler *profiler;
+		void onAction(const event::Action &e) override {
+			profiler->reset();
+		}
+	};
+
+	menu->addChild(new MenuEntry);
+	menu->addChild(createMenuLabel("Profile (" TRS_PROFILE_UNITS " per frame, mean / p99 / max)"));
+	for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+		const ProfileHistogram &h = profiler->stages[i];
+		if (!h.frames.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		menu->addChild(createMenuLabel(string::f("%s: %llu / %llu / %llu", profileStageNames[i],
+			(unsigned long long) h.mean(), (unsigned long long) h.percentile(.99f),
+			(unsigned long long) h.max.load(std::memory_order_relaxed))));
+	}
+
+	DumpItem *dump = createMenuItem<DumpItem>("Dump profile to JSON");
+	dump->profiler = profiler;
+	dump->slug = slug;
+	menu->addChild(dump);
+
+	ResetItem *reset = createMenuItem<ResetItem>("Reset profile");
+	reset->profiler = profiler;
+	menu->addChild(reset);
+
+}
+
+#define _TRS_PROFILE_CONCAT(a, b) a##b
+#define _TRS_PROFILE_NAME(line) _TRS_PROFILE_CONCAT(_profileScope, line)
+#define TRS_PROFILE_FRAME(profiler) (profiler).frame()
+#define TRS_PROFILE_SCOPE(profiler, stage) ProfileScope _TRS_PROFILE_NAME(__LINE__)(profiler, stage)
+
+#else
+
+struct ModuleProfiler {};
+
+#define TRS_PROFILE_FRAME(profiler)
+#define TRS_PROFILE_SCOPE(profiler, stage)
+
+#endif
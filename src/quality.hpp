@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+
+#include "plugin.hpp"
+#include "pitch.hpp"
+#include "oversampling.hpp"
+#include "config.hpp"
+
+// One plugin wide switch for the quality / CPU trade offs the modules used to hard code.
+// The tier lives in TRS.json in Rack's user folder, so it survives restarts and applies to every patch,
+// and each module can pin its own tier from the context menu. Standard is exactly how TRS ran before tiers.
+
+enum QualityTier {
+	// half the oversampling, 4 pole phaser only, coefficients every 4th sample, slower lights
+	QUALITY_ECO,
+	QUALITY_STANDARD,
+	// twice the oversampling, exact pitch curves, faster lights
+	QUALITY_HIGH,
+	NUM_QUALITY_TIERS
+};
+
+/** Defined in plugin.cpp. Written from the UI thread, polled by every module on the audio thread. */
+extern std::atomic<int> globalQuality;
+
+inline std::string qualitySettingsPath(void) {
+	return asset::user("TRS.json");
+}
+
+/** Called once from init(), a missing or unreadable file leaves the tier at Standard. */
+inline void loadQualitySettings(void) {
+	json_t *rootJ = json_load_file(qualitySettingsPath().c_str(), 0, NULL);
+	if (!rootJ) {
+		return;
+	}
+	json_t *qualityJ = json_object_get(rootJ, "quality");
+	if (qualityJ) {
+		globalQuality.store(clamp((int) json_integer_value(qualityJ), 0, NUM_QUALITY_TIERS - 1));
+	}
+	json_decref(rootJ);
+}
+
+inline void saveQualitySettings(void) {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "quality", json_integer(globalQuality.load()));
+	if (json_dump_file(rootJ, qualitySettingsPath().c_str(), JSON_INDENT(2))) {
+		WARN("could not write %s", qualitySettingsPath().c_str());
+	}
+	json_decref(rootJ);
+}
+
+/** The tier one module instance runs at. */
+struct QualityChoice {
+
+	/** -1 follows the plugin wide tier, otherwise this instance's own. Set from the UI, picked up by update(). */
+	ConfigMailbox<int> requested {-1};
+	int tier = -1;
+
+	int target(void) const {
+		int request = requested.read();
+		return (request >= 0) ? std::min(request, NUM_QUALITY_TIERS - 1) : globalQuality.load(std::memory_order_relaxed);
+	}
+
+	/** Returns true when the tier has changed and the module has to reconfigure, called at the top of process(). */
+	bool update(void) {
+		int next = target();
+		if (next == tier) {
+			return false;
+		}
+		tier = next;
+		return true;
+	}
+
+};
+
+/** Internal rate the adaptive oversampling factors aim for at `tier`. */
+inline float qualityOversampleRate(int tier) {
+	const float scale[NUM_QUALITY_TIERS] = {.5f, 1.f, 2.f};
+	return OVERSAMPLE_TARGET_RATE * scale[tier];
+}
+
+/** How many samples a module may hold its filter coefficients for. */
+inline int qualityCoefficientDivision(int tier) {
+	return (tier == QUALITY_ECO) ? 4 : 1;
+}
+
+/** How many samples between light updates. */
+inline int qualityLightDivision(int tier) {
+	const int division[NUM_QUALITY_TIERS] = {64, 16, 4};
+	return division[tier];
+}
+
+/** voltsToNormal() with the pitch curve the tier asks for. */
+template <typename T>
+inline T qualityVoltsToNormal(int tier, T volts, float baseHz, float minVolts, float maxVolts, float sampleTime, T fm = T(1.f)) {
+	if (tier == QUALITY_HIGH) {
+		return voltsToNormal<PITCH_HIGH>(volts, baseHz, minVolts, maxVolts, sampleTime, fm);
+	}
+	return voltsToNormal<PITCH_STANDARD>(volts, baseHz, minVolts, maxVolts, sampleTime, fm);
+}
+
+inline void appendQualityMenu(Menu *menu, QualityChoice *choice) {
+
+	static const char *names[NUM_QUALITY_TIERS] = {"Eco", "Standard", "High"};
+
+	struct InstanceHandler : MenuItem {
+		QualityChoice *choice;
+		int requested;
+		void onAction(const event::Action &e) override {
+			choice->requested.post(requested);
+		}
+	};
+
+	struct GlobalHandler : MenuItem {
+		int tier;
+		void onAction(const event::Action &e) override {
+			globalQuality.store(tier);
+			saveQualitySettings();
+		}
+	};
+
+	struct QualityItem : MenuItem {
+		QualityChoice *choice;
+		Menu *createChildMenu() override {
+			Menu *menu = new Menu();
+			int global = globalQuality.load();
+
+			menu->addChild(createMenuLabel("This module"));
+			InstanceHandler *follow = createMenuItem<InstanceHandler>(string::f("Plugin default (%s)", names[global]), CHECKMARK(choice->requested.read() < 0));
+			follow->choice = choice;
+			follow->requested = -1;
+			menu->addChild(follow);
+			for (int i = 0; i < NUM_QUALITY_TIERS; i++) {
+				InstanceHandler *menuItem = createMenuItem<InstanceHandler>(names[i], CHECKMARK(choice->requested.read() == i));
+				menuItem->choice = choice;
+				menuItem->requested = i;
+				menu->addChild(menuItem);
+			}
+
+			menu->addChild(new MenuEntry);
+			menu->addChild(createMenuLabel("Plugin default, all TRS modules"));
+			for (int i = 0; i < NUM_QUALITY_TIERS; i++) {
+				GlobalHandler *menuItem = createMenuItem<GlobalHandler>(names[i], CHECKMARK(global == i));
+				menuItem->tier = i;
+				menu->addChild(menuItem);
+			}
+			return menu;
+		}
+	};
+
+	menu->addChild(new MenuEntry);
+	QualityItem *quality = createMenuItem<QualityItem>("Quality");
+	quality->choice = choice;
+	quality->rightText = std::string(names[choice->target()]) + " " + RIGHT_ARROW;
+	menu->addChild(quality);
+
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include "trs.hpp"
+
+// Processing stages lifted out of the TRS modules so they can be fused into one process() call.
+// TRSPHASER and TRSBBD only run on the first voice of each side, so a chain ending in them only ever
+// carries that voice. Both sides ride in one float_4, left in lane 0 and right in lane 1 as in StereoPhaser,
+// and every stage hands the processed pair to the next in registers instead of through ports.
+
+/** Control values shared by all the stages of a chain, refreshed once per sample. The stages only work out
+ *  their coefficients again when one of them has moved. */
+struct ChainControls {
+	float sampleTime = 1.f / 44100.f;
+
+	float drive = 0.f;
+	/** Left pitch in lane 0, right in lane 1. */
+	float_4 pitch = float_4(0.f);
+	float res = 0.f;
+	float depth = 0.f;
+	float bias = 0.f;
+	float phase = 0.f;
+	float phaseFeedback = 0.f;
+	float tone = 0.f;
+	float time = 0.f;
+	float feedback = 0.f;
+
+	bool matches(const ChainControls &o) const {
+		return sampleTime == o.sampleTime && drive == o.drive && movemask(pitch != o.pitch) == 0 && res == o.res
+			&& depth == o.depth && bias == o.bias && phase == o.phase && phaseFeedback == o.phaseFeedback
+			&& tone == o.tone && time == o.time && feedback == o.feedback;
+	}
+};
+
+/** TRSPRE's zener clipper. */
+struct PreStage {
+
+	ZenerClipperBL<float_4> clipper;
+
+	float_4 gain = float_4(0.f);
+
+	void setControls(const ChainControls &c) {
+		gain = float_4(c.drive / 6.5f);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {}
+
+	void reset() {
+		clipper = ZenerClipperBL<float_4>();
+	}
+
+	// state lives in starling-dsp, the engine guard keeps it out of the subnormal range
+	int flushDenormals() {
+		return 0;
+	}
+
+	float_4 process(float_4 in) {
+		return clipper.process(in * gain) * float_4(6.5f);
+	}
+
+};
+
+/** TRSVCF's state variable filter, lowpass tap. */
+struct VCFStage {
+
+	ZDFSVF<float_4> filter;
+
+	void setControls(const ChainControls &c) {
+		float r = clamp(c.res, 0.f, 1.f);
+		r = dsp::approxExp2_taylor5((1.f - r) * 8.f) / 256.f;
+		freq = voltsToNormal(c.pitch, 480.f, -10.f, 10.f, c.sampleTime);
+		res = float_4(1.f - r + 1.f/256.f);
+		filter.setParams(freq, res);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {}
+
+	/** The coefficients set by setControls(), kept so a cleared filter can be given them back. */
+	float_4 freq = float_4(0.f);
+	float_4 res = float_4(0.f);
+
+	void reset() {
+		filter = ZDFSVF<float_4>();
+		filter.setParams(freq, res);
+	}
+
+	// state lives in starling-dsp, a decayed filter shows in its outputs and is cleared whole
+	int flushDenormals() {
+		int seen = countSubnormals(filter.lpOut) + countSubnormals(filter.bpOut);
+		if (seen) {
+			reset();
+		}
+		return seen;
+	}
+
+	float_4 process(float_4 in) {
+		filter.process(in);
+		return filter.lpOut;
+	}
+
+};
+
+/** TRSSINCOS's oversampled sine shaper, sine on both sides. */
+struct SincosStage {
+
+	#define SINCOS_STAGE_MAX_OVERSAMPLE 8
+
+	trs::UpsamplePow2<SINCOS_STAGE_MAX_OVERSAMPLE, float_4> upsampler;
+	trs::DecimatePow2<SINCOS_STAGE_MAX_OVERSAMPLE, float_4> decimator;
+
+	float_4 work[SINCOS_STAGE_MAX_OVERSAMPLE];
+
+	int factor = SINCOS_STAGE_MAX_OVERSAMPLE;
+
+	float_4 depth = float_4(0.f);
+	float_4 bias = float_4(0.f);
+
+	void setControls(const ChainControls &c) {
+		depth = float_4(clamp(c.depth, 0.f, 1.f) * (2.f / 5.f));
+		bias = float_4(c.bias);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {
+		factor = trs::adaptiveFactor(1.f / sampleTime, SINCOS_STAGE_MAX_OVERSAMPLE, oversampleRate);
+		upsampler.setFactor(factor);
+		decimator.setFactor(factor);
+	}
+
+	void reset() {
+		upsampler.reset();
+		decimator.reset();
+	}
+
+	int flushDenormals() {
+		return upsampler.flushDenormals() + decimator.flushDenormals();
+	}
+
+	float_4 process(float_4 in) {
+		// scale -5 to 5 to -2 to 2
+		in = (in + bias) * depth;
+		upsampler.process(in, work);
+		for (int i = 0; i < factor; i++) {
+			work[i] = bhaskaraSine<float_4, int32_4>(work[i]);
+		}
+		return decimator.process(work) * float_4(5.f);
+	}
+
+};
+
+/** TRSXOVER's crossover, low band only. */
+struct XoverStage {
+
+	JOSSVF<float_4> filter;
+
+	float tone = 0.f;
+
+	void setControls(const ChainControls &c) {
+		tone = c.tone;
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {}
+
+	void reset() {
+		filter = JOSSVF<float_4>();
+	}
+
+	// JOSSVF takes its coefficients on every call, so clearing it only loses the decayed state
+	int flushDenormals() {
+		int seen = countSubnormals(filter.lpOut) + countSubnormals(filter.hpOut);
+		if (seen) {
+			reset();
+		}
+		return seen;
+	}
+
+	float_4 process(float_4 in) {
+		filter.process(tone, .75f, in, 0.f, 0.f, 0.f);
+		return filter.lpOut;
+	}
+
+};
+
+/** TRSPHASER's 4 pole phaser at the classic notch mix, both sides in the one packed cascade. */
+struct PhaserStage {
+
+	StereoPhaser<4> phaser;
+
+	void setControls(const ChainControls &c) {
+		float freq = voltsToNormal(c.phase, 480.f, -5.f, 5.f, c.sampleTime);
+		phaser.setParams(freq, freq, c.phaseFeedback);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {}
+
+	void reset() {
+		phaser.reset();
+	}
+
+	int flushDenormals() {
+		return phaser.flushDenormals();
+	}
+
+	float_4 process(float_4 in) {
+		return (phaser.process(in) + in) * float_4(.5f);
+	}
+
+};
+
+/** TRSBBD's oversampled bucket brigade with feedback, one scalar line per side. */
+struct BBDStage {
+
+	#define BBD_STAGE_MAX_OVERSAMPLE 8
+
+	BBD<float> bbds[2];
+
+	trs::UpsamplePow2<BBD_STAGE_MAX_OVERSAMPLE, float> upsamplers[2];
+	trs::DecimatePow2<BBD_STAGE_MAX_OVERSAMPLE, float> decimators[2];
+
+	float work[BBD_STAGE_MAX_OVERSAMPLE];
+
+	int factor = BBD_STAGE_MAX_OVERSAMPLE;
+
+	float last[2] = {0.f, 0.f};
+
+	float clock = 14000.f;
+	float fb = 0.f;
+	/** The oversampled sample time the bucket filters were formed for. */
+	float bucketTime = 1.f / (BBD_STAGE_MAX_OVERSAMPLE * 44100.f);
+
+	void setControls(const ChainControls &c) {
+		clock = timeToClock(clamp(c.time, 0.f, 1.f), 14000.f, 3.f);
+		fb = clamp(c.feedback, 0.f, .75f);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {
+		factor = trs::adaptiveFactor(1.f / sampleTime, BBD_STAGE_MAX_OVERSAMPLE, oversampleRate);
+		for (int side = 0; side < 2; side++) {
+			upsamplers[side].setFactor(factor);
+			decimators[side].setFactor(factor);
+			bbds[side].reformFilters(sampleTime / factor);
+		}
+		bucketTime = sampleTime / factor;
+	}
+
+	// emptied too, or whatever the line held when this order was last heard would fade in with it
+	void reset() {
+		for (int side = 0; side < 2; side++) {
+			bbds[side] = BBD<float>();
+			bbds[side].reformFilters(bucketTime);
+			upsamplers[side].reset();
+			decimators[side].reset();
+			last[side] = 0.f;
+		}
+	}
+
+	int flushDenormals() {
+		int seen = flushDenormal(last[0]) + flushDenormal(last[1]);
+		for (int side = 0; side < 2; side++) {
+			seen += upsamplers[side].flushDenormals();
+			seen += decimators[side].flushDenormals();
+		}
+		return seen;
+	}
+
+	float_4 process(float_4 in) {
+		for (int side = 0; side < 2; side++) {
+			upsamplers[side].process(in[side] + last[side] * fb, work);
+			for (int i = 0; i < factor; i++) {
+				work[i] = bbds[side].process(work[i], clock);
+			}
+			last[side] = decimators[side].process(work);
+		}
+		return float_4(last[0], last[1], 0.f, 0.f);
+	}
+
+};
+
+/** Compile time pipeline, each stage feeds the next one without leaving registers. */
+template <typename... Stages>
+struct StageChain;
+
+template <>
+struct StageChain<> {
+
+	void setControls(const ChainControls &c) {}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {}
+
+	void reset() {}
+
+	int flushDenormals() {
+		return 0;
+	}
+
+	float_4 process(float_4 in) {
+		return in;
+	}
+
+};
+
+template <typename Head, typename... Tail>
+struct StageChain<Head, Tail...> {
+
+	Head head;
+	StageChain<Tail...> tail;
+
+	void setControls(const ChainControls &c) {
+		head.setControls(c);
+		tail.setControls(c);
+	}
+
+	void setSampleTime(float sampleTime, float oversampleRate) {
+		head.setSampleTime(sampleTime, oversampleRate);
+		tail.setSampleTime(sampleTime, oversampleRate);
+	}
+
+	void reset() {
+		head.reset();
+		tail.reset();
+	}
+
+	int flushDenormals() {
+		return head.flushDenormals() + tail.flushDenormals();
+	}
+
+	inline float_4 process(float_4 in) {
+		return tail.process(head.process(in));
+	}
+
+};
+
+/** Type erased handle on one stage order so the module can switch orders with a single indirect call per sample. */
+struct ChainEngine {
+
+	virtual ~ChainEngine() {}
+
+	/** `oversampleRate` is the internal rate the oversampled stages aim for, see qualityOversampleRate(). */
+	virtual void setSampleTime(float sampleTime, float oversampleRate) = 0;
+
+	/** Clears what the stages remember from the last time this order ran, before it is switched in. */
+	virtual void reset() = 0;
+
+	/** Zeroes decayed state in every stage, returns the number of subnormals found. */
+	virtual int flushDenormals() = 0;
+
+	/** Runs the first voice of both sides, left in lane 0 and right in lane 1. */
+	virtual float_4 process(const ChainControls &c, float_4 in) = 0;
+
+};
+
+template <typename... Stages>
+struct ChainEngineImpl : ChainEngine {
+
+	StageChain<Stages...> chain;
+
+	/** The controls the stages' coefficients were last worked out from, unusable after a reset. */
+	ChainControls applied;
+	bool stale = true;
+
+	void setSampleTime(float sampleTime, float oversampleRate) override {
+		chain.setSampleTime(sampleTime, oversampleRate);
+		stale = true;
+	}
+
+	void reset() override {
+		chain.reset();
+		stale = true;
+	}
+
+	int flushDenormals() override {
+		return chain.flushDenormals();
+	}
+
+	float_4 process(const ChainControls &c, float_4 in) override {
+		if (stale || !c.matches(applied)) {
+			chain.setControls(c);
+			applied = c;
+			stale = false;
+		}
+		return chain.process(in);
+	}
+
+};
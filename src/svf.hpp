@@ -0,0 +1,136 @@
+#pragma once
+
+#include "plugin.hpp"
+#include "denormal.hpp"
+#include "pitch.hpp"
+
+// Trapezoidal (TPT) state variable filter after Andrew Simper's "Linear Trap Integrated SVF",
+// and the Linkwitz-Riley band splitter TRSXOVER builds on it. Coefficients are plain floats
+// shared by every voice, so they can be cached by the module and only rebuilt when a knob moves.
+
+#define SVF_BUTTERWORTH_K 1.41421356f
+
+struct SVFCoefficients {
+
+	float g = 0.f;
+	float k = SVF_BUTTERWORTH_K;
+	float a1 = 1.f;
+	float a2 = 0.f;
+	float a3 = 0.f;
+
+	/** `k` is 1 / Q, the default gives a Butterworth response. */
+	void set(float normal, float damping = SVF_BUTTERWORTH_K) {
+		g = normalToG(normal);
+		k = damping;
+		a1 = 1.f / (1.f + g * (g + k));
+		a2 = g * a1;
+		a3 = g * a2;
+	}
+
+};
+
+template <typename T>
+struct TPTSVF {
+
+	T ic1 = T(0.f);
+	T ic2 = T(0.f);
+
+	T lpOut = T(0.f);
+	T bpOut = T(0.f);
+	T hpOut = T(0.f);
+
+	inline void process(T in, const SVFCoefficients &c) {
+		T v3 = in - ic2;
+		T v1 = T(c.a1) * ic1 + T(c.a2) * v3;
+		T v2 = ic2 + T(c.a2) * ic1 + T(c.a3) * v3;
+		ic1 = T(2.f) * v1 - ic1;
+		ic2 = T(2.f) * v2 - ic2;
+		lpOut = v2;
+		bpOut = v1;
+		hpOut = in - T(c.k) * v1 - v2;
+	}
+
+	/** Second order allpass with the same poles, lp + hp of an LR4 split sums to this. */
+	inline T allpass(T in, const SVFCoefficients &c) {
+		process(in, c);
+		return in - T(2.f * c.k) * bpOut;
+	}
+
+	int flushDenormals() {
+		return flushDenormal(ic1) + flushDenormal(ic2);
+	}
+
+};
+
+/** Fourth order Linkwitz-Riley split, two Butterworth sections per side.
+ *  The first section is shared, one SVF gives both the lowpass and the highpass of the same input. */
+template <typename T>
+struct LR4Split {
+
+	TPTSVF<T> first;
+	TPTSVF<T> low2;
+	TPTSVF<T> high2;
+
+	T low = T(0.f);
+	T high = T(0.f);
+
+	inline void process(T in, const SVFCoefficients &c) {
+		first.process(in, c);
+		low2.process(first.lpOut, c);
+		high2.process(first.hpOut, c);
+		low = low2.lpOut;
+		high = high2.hpOut;
+	}
+
+	int flushDenormals() {
+		return first.flushDenormals() + low2.flushDenormals() + high2.flushDenormals();
+	}
+
+};
+
+/** Two to four band Linkwitz-Riley tree. Each split peels the lowest band off what is left above the previous one,
+ *  and the bands below a split are passed through that split's allpass so every band sums back in phase. */
+template <typename T>
+struct LRCrossover {
+
+	#define LR_MAX_BANDS 4
+
+	LR4Split<T> splits[LR_MAX_BANDS - 1];
+	// [band][split], band b only needs the allpasses of the splits above it
+	TPTSVF<T> compensation[LR_MAX_BANDS - 2][LR_MAX_BANDS - 1];
+
+	T bands[LR_MAX_BANDS];
+
+	/** `coefficients` holds numBands - 1 splits, lowest frequency first. */
+	inline void process(T in, int numBands, const SVFCoefficients *coefficients) {
+		T rest = in;
+		int numSplits = numBands - 1;
+		for (int s = 0; s < numSplits; s++) {
+			splits[s].process(rest, coefficients[s]);
+			T band = splits[s].low;
+			for (int above = s + 1; above < numSplits; above++) {
+				band = compensation[s][above].allpass(band, coefficients[above]);
+			}
+			bands[s] = band;
+			rest = splits[s].high;
+		}
+		bands[numSplits] = rest;
+		for (int b = numBands; b < LR_MAX_BANDS; b++) {
+			bands[b] = T(0.f);
+		}
+	}
+
+	int flushDenormals() {
+		int seen = 0;
+		for (int s = 0; s < LR_MAX_BANDS - 1; s++) {
+			seen += splits[s].flushDenormals();
+		}
+		for (int b = 0; b < LR_MAX_BANDS - 2; b++) {
+			for (int s = 0; s < LR_MAX_BANDS - 1; s++) {
+				seen += compensation[b][s].flushDenormals();
+			}
+		}
+		return seen;
+	}
+
+};
@@ -1,13 +1,32 @@
+#pragma once
+
 #include "plugin.hpp"
 #include "ui.hpp"
 #include "starling-dsp.hpp"
+#include "denormal.hpp"
+#include "idle.hpp"
+#include "voices.hpp"
+#include "config.hpp"
+#include "profile.hpp"
+#include "pitch.hpp"
+#include "svf.hpp"
+#include "phaser.hpp"
+#include "matrix.hpp"
+#include "block.hpp"
+// namespaced so it can sit next to the copy in the starling-dsp submodule
+#include "oversampling.hpp"
+#include "quality.hpp"
+#include "footprint.hpp"
 
 using simd::float_4;
 using simd::int32_4;
 
-struct StereoInHandler : Input {
+// The handlers are views onto a module's own jacks, one pointer each, so a module can hold a dozen of them
+// without carrying a dozen unused 16 channel ports around.
+
+struct StereoInHandler {
 
-	Input * input;
+	Input * input = NULL;
 
 	void configure(Input * inputJack) {
 		input = inputJack;
@@ -23,6 +42,38 @@ struct StereoInHandler : Input {
 		return input->getVoltageSimd<float_4>(8 + polySection * 4);
 	}
 
+	bool isConnected(void) {
+		return input->isConnected();
+	}
+
+	/** Voices 2 * pair and 2 * pair + 1 of both sides, see voices.hpp. */
+	float_4 getPair(int pair) {
+		pair &= 3;
+		return loadVoicePair(input->getVoltages(2 * pair), input->getVoltages(8 + 2 * pair));
+	}
+
+	/** The same pair of left voices in both halves, for inputs that feed both sides. */
+	float_4 getLeftPair(int pair) {
+		pair &= 3;
+		return loadVoicePair(input->getVoltages(2 * pair), input->getVoltages(2 * pair));
+	}
+
+	/** True when each left voice carries the same voltage as its right voice, as when unpatched or fed one mono voltage. */
+	bool linked(void) {
+		const float *v = input->getVoltages();
+		float_4 differ = (float_4::load(v) != float_4::load(v + 8)) | (float_4::load(v + 4) != float_4::load(v + 12));
+		return movemask(differ) == 0;
+	}
+
+	/** True when all 16 channels carry channel 0's voltage, so one value stands for every voice on both sides. */
+	bool uniform(void) {
+		const float *v = input->getVoltages();
+		float_4 first = float_4(v[0]);
+		float_4 differ = (float_4::load(v) != first) | (float_4::load(v + 4) != first);
+		differ = differ | (float_4::load(v + 8) != first) | (float_4::load(v + 12) != first);
+		return movemask(differ) == 0;
+	}
+
 	float getLeft(void) {
 		return input->getVoltage(0);
 	}
@@ -49,11 +100,20 @@ struct StereoInHandler : Input {
 		return input->getNormalVoltage(normal, 8);
 	}
 
+	/** Per lane max of |v| over all 16 channels, both sides. */
+	float_4 peak(void) {
+		float_4 p = abs(input->getVoltageSimd<float_4>(0));
+		p = fmax(p, abs(input->getVoltageSimd<float_4>(4)));
+		p = fmax(p, abs(input->getVoltageSimd<float_4>(8)));
+		p = fmax(p, abs(input->getVoltageSimd<float_4>(12)));
+		return p;
+	}
+
 };
 
-struct StereoOutHandler : Output {
+struct StereoOutHandler {
 
-	Output * output;
+	Output * output = NULL;
 
 	void configure(Output * outputJack) {
 		output = outputJack;
@@ -69,6 +129,11 @@ struct StereoOutHandler : Output {
 		return output->setVoltageSimd<float_4>(value, 8 + polySection * 4);
 	}
 
+	void setPair(float_4 value, int pair) {
+		pair &= 3;
+		storeVoicePair(output->getVoltages(2 * pair), output->getVoltages(8 + 2 * pair), value);
+	}
+
 	void setLeft(float value) {
 		return output->setVoltage(value, 0);
 	}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "plugin.hpp"
+#include "idle.hpp"
+
+using simd::float_4;
+
+// Voice pair packing for the per voice modules. A TRS cable carries voice v on channel v (left) and
+// 8 + v (right), so a lone stereo voice leaves three lanes of each side's float_4 empty. A pair
+// packs voices 2g and 2g + 1 of both sides into one float_4, left in lanes 0-1 and right in lanes 2-3,
+// and VoiceActivity tells the module which of the four pairs carry signal so the rest are skipped.
+// Pair g always holds the same voices, so DSP state never has to move when voices come and go.
+
+#define VOICE_PAIRS 4
+
+/** Two consecutive left channels into lanes 0-1 and two right channels into lanes 2-3. */
+inline float_4 loadVoicePair(const float *left, const float *right) {
+	__m128 v = _mm_setzero_ps();
+	v = _mm_loadl_pi(v, (const __m64 *) left);
+	v = _mm_loadh_pi(v, (const __m64 *) right);
+	return float_4(v);
+}
+
+inline void storeVoicePair(float *left, float *right, float_4 v) {
+	_mm_storel_pi((__m64 *) left, v.v);
+	_mm_storeh_pi((__m64 *) right, v.v);
+}
+
+/** A per side constant laid out like a pair. */
+inline float_4 sidePair(float left, float right) {
+	return float_4(left, left, right, right);
+}
+
+/** One IdleDetector per voice pair, wake() and settle() work as they do for a whole module. */
+struct VoiceActivity {
+
+	IdleDetector pairs[VOICE_PAIRS];
+
+	void setTail(float seconds, float sampleRate) {
+		for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+			pairs[pair].setTail(seconds, sampleRate);
+		}
+	}
+
+	/** Returns true when `pair` has to run this sample. */
+	inline bool wake(int pair, float_4 inputLevel) {
+		return pairs[pair].wake(hmax(inputLevel));
+	}
+
+	/** Returns true on the sample `pair` falls asleep. */
+	inline bool settle(int pair, float_4 outputLevel, int samples = 1) {
+		return pairs[pair].settle(hmax(outputLevel), samples);
+	}
+
+	bool awake(int pair) const {
+		return !pairs[pair].asleep;
+	}
+
+};
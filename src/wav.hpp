@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Minimal RIFF WAVE parsing on a buffer that is already in memory, either mapped by the offline tools
+// or read in by a module. PCM 16 / 24 / 32 bit and 32 bit float are understood, everything comes out as float.
+
+struct WavInfo {
+	int channels = 0;
+	int sampleRate = 0;
+	int bitsPerSample = 0;
+	bool isFloat = false;
+	/** Offset and size of the sample data inside the buffer. */
+	size_t dataOffset = 0;
+	size_t dataSize = 0;
+	size_t frames = 0;
+
+	int bytesPerFrame(void) const {
+		return channels * (bitsPerSample / 8);
+	}
+};
+
+#define WAV_HEADER_SIZE 44
+
+inline uint32_t wavRead32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+inline uint16_t wavRead16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+inline void wavWrite32(uint8_t *p, uint32_t x) {
+	p[0] = x & 0xff;
+	p[1] = (x >> 8) & 0xff;
+	p[2] = (x >> 16) & 0xff;
+	p[3] = (x >> 24) & 0xff;
+}
+
+inline void wavWrite16(uint8_t *p, uint16_t x) {
+	p[0] = x & 0xff;
+	p[1] = (x >> 8) & 0xff;
+}
+
+/** The formats wavSample() can read, PCM 16 / 24 / 32 bit and 32 bit float. */
+inline bool wavFormatSupported(int format, int bitsPerSample) {
+	if (format == 3) {
+		return bitsPerSample == 32;
+	}
+	return format == 1 && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+}
+
+/** Walks the chunk list for "fmt " and "data", returns false on anything it does not understand. */
+inline bool parseWav(const uint8_t *data, size_t size, WavInfo *info) {
+	if (size < 12 || std::memcmp(data, "RIFF", 4) || std::memcmp(data + 8, "WAVE", 4)) {
+		return false;
+	}
+	bool haveFormat = false;
+	size_t pos = 12;
+	while (pos + 8 <= size) {
+		const uint8_t *chunk = data + pos;
+		size_t chunkSize = wavRead32(chunk + 4);
+		const uint8_t *body = chunk + 8;
+		if (!std::memcmp(chunk, "fmt ", 4) && chunkSize >= 16 && pos + 8 + 16 <= size) {
+			int format = wavRead16(body);
+			// WAVE_FORMAT_EXTENSIBLE keeps the real format at the start of the sub format GUID
+			if (format == 0xfffe) {
+				if (chunkSize < 40 || pos + 8 + chunkSize > size) {
+					return false;
+				}
+				format = wavRead16(body + 24);
+			}
+			info->channels = wavRead16(body + 2);
+			info->sampleRate = wavRead32(body + 4);
+			info->bitsPerSample = wavRead16(body + 14);
+			info->isFloat = (format == 3);
+			if (!wavFormatSupported(format, info->bitsPerSample) || info->channels < 1 || info->sampleRate < 1) {
+				return false;
+			}
+			haveFormat = true;
+		} else if (!std::memcmp(chunk, "data", 4)) {
+			if (!haveFormat) {
+				return false;
+			}
+			info->dataOffset = pos + 8;
+			// streams cut short, or written with a placeholder size, stop at the end of the buffer
+			info->dataSize = (chunkSize > size - info->dataOffset) ? size - info->dataOffset : chunkSize;
+			info->frames = info->dataSize / info->bytesPerFrame();
+			return true;
+		}
+		pos += 8 + chunkSize + (chunkSize & 1);
+	}
+	return false;
+}
+
+/** One sample of `info`'s format at `p`, scaled to -1 to 1. */
+inline float wavSample(const uint8_t *p, const WavInfo &info) {
+	if (info.isFloat) {
+		float x;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+	switch (info.bitsPerSample) {
+		case 16:
+			return (int16_t) wavRead16(p) / 32768.f;
+		case 24:
+			return (int32_t) ((p[0] << 8) | (p[1] << 16) | ((uint32_t) p[2] << 24)) / 2147483648.f;
+		case 32:
+			return (int32_t) wavRead32(p) / 2147483648.f;
+		default:
+			return 0.f;
+	}
+}
+
+/** Header for a 32 bit float file, the samples follow at WAV_HEADER_SIZE. */
+inline void writeWavHeader(uint8_t *p, int channels, int sampleRate, size_t frames) {
+	uint32_t dataSize = frames * channels * sizeof(float);
+	std::memcpy(p, "RIFF", 4);
+	wavWrite32(p + 4, 36 + dataSize);
+	std::memcpy(p + 8, "WAVEfmt ", 8);
+	wavWrite32(p + 16, 16);
+	wavWrite16(p + 20, 3);
+	wavWrite16(p + 22, channels);
+	wavWrite32(p + 24, sampleRate);
+	wavWrite32(p + 28, sampleRate * channels * sizeof(float));
+	wavWrite16(p + 32, channels * sizeof(float));
+	wavWrite16(p + 34, 32);
+	std::memcpy(p + 36, "data", 4);
+	wavWrite32(p + 40, dataSize);
+}
@@ -0,0 +1,220 @@
+#include "render.hpp"
+#include "scheduler.hpp"
+
+#include <chrono>
+
+// trs-batch batch.json [--threads N] [--scaling]
+// Renders many independent graphs at once on a work stealing pool and reports aggregate throughput.
+// With --scaling the batch is repeated at 1, 2, 4 ... N threads to give a per core scaling curve.
+//
+// {"sampleRate": 48000,
+//  "jobs": [{"graph": "a.json", "in": "a.wav", "out": "a-out.wav"}, ...],
+//  "synthetic": {"graph": "voice.json", "instances": 256, "seconds": 10}}
+//
+// File jobs must all be at the same sample rate, Rack keeps one rate per engine. Synthetic instances
+// run white noise through the graph and throw the output away, the real time factor of a synthetic
+// batch is how many of those voices the machine can run at once.
+
+struct BatchJob {
+	std::string graph;
+	std::string in;
+	std::string out;
+	// synthetic jobs have no files
+	int64_t frames = 0;
+};
+
+struct BatchResult {
+	int threads;
+	double wallSeconds;
+	double audioSeconds;
+	std::vector<WorkerStats> workers;
+};
+
+static bool loadBatch(const char *path, std::vector<BatchJob> *jobs, float *sampleRate, std::string *error) {
+	json_t *rootJ = loadGraphJson(path, error);
+	if (!rootJ) {
+		return false;
+	}
+
+	json_t *sampleRateJ = json_object_get(rootJ, "sampleRate");
+	*sampleRate = sampleRateJ ? json_number_value(sampleRateJ) : 0.f;
+
+	size_t i;
+	json_t *jobJ;
+	json_array_foreach(json_object_get(rootJ, "jobs"), i, jobJ) {
+		BatchJob job;
+		const char *graph = json_string_value(json_object_get(jobJ, "graph"));
+		const char *in = json_string_value(json_object_get(jobJ, "in"));
+		const char *out = json_string_value(json_object_get(jobJ, "out"));
+		if (!graph || !in || !out) {
+			*error = string::f("job %d needs \"graph\", \"in\" and \"out\"", (int) i);
+			json_decref(rootJ);
+			return false;
+		}
+		int rate = wavSampleRate(in);
+		if (*sampleRate == 0.f) {
+			*sampleRate = rate;
+		}
+		if (rate != (int) *sampleRate) {
+			*error = string::f("%s is at %d Hz, the batch runs at %d Hz", in, rate, (int) *sampleRate);
+			json_decref(rootJ);
+			return false;
+		}
+		job.graph = graph;
+		job.in = in;
+		job.out = out;
+		jobs->push_back(job);
+	}
+
+	if (*sampleRate == 0.f) {
+		*sampleRate = 48000.f;
+	}
+
+	json_t *syntheticJ = json_object_get(rootJ, "synthetic");
+	if (syntheticJ) {
+		const char *graph = json_string_value(json_object_get(syntheticJ, "graph"));
+		int instances = json_integer_value(json_object_get(syntheticJ, "instances"));
+		double seconds = json_number_value(json_object_get(syntheticJ, "seconds"));
+		if (!graph || instances < 1 || seconds <= 0.0) {
+			*error = "\"synthetic\" needs \"graph\", \"instances\" and \"seconds\"";
+			json_decref(rootJ);
+			return false;
+		}
+		for (int n = 0; n < instances; n++) {
+			BatchJob job;
+			job.graph = graph;
+			job.frames = seconds * *sampleRate;
+			jobs->push_back(job);
+		}
+	}
+
+	json_decref(rootJ);
+	return true;
+}
+
+static BatchResult runBatch(HeadlessRack *rack, const std::vector<BatchJob> &jobs, int threads, std::vector<std::string> *errors) {
+	WorkStealingPool pool(threads);
+	std::mutex errorMutex;
+	std::atomic<int64_t> frames {0};
+
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const BatchJob *job = &jobs[i];
+		pool.push([rack, job, i, &frames, &errors, &errorMutex](int worker) {
+			std::string error;
+			int64_t rendered = -1;
+			// each job parses its own graph and allocates its own modules on the worker that runs it
+			json_t *rootJ = loadGraphJson(job->graph.c_str(), &error);
+			if (rootJ) {
+				HeadlessGraph graph;
+				if (graph.load(rootJ, rack, &error)) {
+					if (job->frames) {
+						graph.setSampleRate(APP->engine->getSampleRate());
+						graph.finishLoading();
+						renderNoise(&graph, job->frames, i + 1);
+						rendered = job->frames;
+					} else {
+						rendered = renderWav(&graph, job->in.c_str(), job->out.c_str(), &error);
+					}
+				}
+				json_decref(rootJ);
+			}
+			if (rendered < 0) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				errors->push_back(error);
+				return;
+			}
+			frames += rendered;
+		});
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	pool.run([rack](int worker) {
+		rack->attachThread();
+	});
+
+	BatchResult result;
+	result.threads = threads;
+	result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.audioSeconds = frames.load() / (double) APP->engine->getSampleRate();
+	result.workers = pool.stats;
+	return result;
+}
+
+int main(int argc, char **argv) {
+	const char *batchPath = NULL;
+	int maxThreads = std::thread::hardware_concurrency();
+	bool scaling = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) {
+			maxThreads = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--scaling") {
+			scaling = true;
+		} else {
+			batchPath = argv[i];
+		}
+	}
+
+	if (!batchPath) {
+		fprintf(stderr, "usage: %s batch.json [--threads N] [--scaling]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<BatchJob> jobs;
+	float sampleRate;
+	std::string error;
+	if (!loadBatch(batchPath, &jobs, &sampleRate, &error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	HeadlessRack rack;
+	rack.start(sampleRate);
+
+	std::vector<int> threadCounts;
+	if (scaling) {
+		for (int threads = 1; threads < maxThreads; threads *= 2) {
+			threadCounts.push_back(threads);
+		}
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::vector<std::string> errors;
+	std::vector<BatchResult> results;
+	for (int threads : threadCounts) {
+		results.push_back(runBatch(&rack, jobs, threads, &errors));
+		if (!errors.empty()) {
+			break;
+		}
+	}
+
+	for (std::string &e : errors) {
+		fprintf(stderr, "%s\n", e.c_str());
+	}
+
+	printf("%d jobs at %d Hz\n\n", (int) jobs.size(), (int) sampleRate);
+	printf("threads    wall s   audio s   x real time   speedup   efficiency   steals\n");
+	double single = results.empty() ? 0.0 : results[0].audioSeconds / results[0].wallSeconds;
+	for (BatchResult &result : results) {
+		double realTime = result.audioSeconds / result.wallSeconds;
+		int steals = 0;
+		for (WorkerStats &worker : result.workers) {
+			steals += worker.steals;
+		}
+		printf("%7d  %8.3f  %8.1f  %12.1f  %8.2f  %10.0f%%  %7d\n", result.threads, result.wallSeconds, result.audioSeconds,
+			realTime, realTime / single, 100.0 * realTime / single / result.threads, steals);
+	}
+
+	if (!results.empty()) {
+		BatchResult &last = results.back();
+		printf("\nworker   jobs   steals   busy\n");
+		for (int worker = 0; worker < (int) last.workers.size(); worker++) {
+			WorkerStats &stats = last.workers[worker];
+			printf("%6d  %5d  %7d  %4.0f%%\n", worker, stats.jobs, stats.steals, 100.0 * stats.busySeconds / last.wallSeconds);
+		}
+	}
+
+	rack.stop();
+	return errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+#include "../src/trs.hpp"
+
+#include <chrono>
+
+// trs-bench [--samples N]
+// Times the starling-dsp primitives and Rack approximations the modules are built on, one at a time,
+// in ns per call and ns per voice (a float_4 call runs four voices). Coefficient paths are timed apart
+// from process paths since the modules call them at different rates. Accuracy tables for the
+// approximations against libm close the report.
+
+#define BENCH_NOISE_SIZE 4096
+
+static float noise[BENCH_NOISE_SIZE];
+
+// stores to this keep the compiler from dropping the loops
+static volatile float sink;
+
+/** For the coefficient paths of starling-dsp types, which don't expose a coefficient to store to `sink`:
+ *  the compiler has to assume `object` is read here, so the update before it can't be dropped. */
+template <typename T>
+inline void keep(const T &object) {
+	asm volatile("" : : "r"(&object) : "memory");
+}
+
+inline float lane0(float x) {
+	return x;
+}
+
+inline float lane0(float_4 x) {
+	return x[0];
+}
+
+inline float magnitude(float x) {
+	return std::fabs(x);
+}
+
+inline float_4 magnitude(float_4 x) {
+	return simd::abs(x);
+}
+
+template <typename T>
+inline T noiseAt(int i) {
+	return T(noise[i & (BENCH_NOISE_SIZE - 1)]);
+}
+
+template <>
+inline float_4 noiseAt<float_4>(int i) {
+	return float_4::load(&noise[i & (BENCH_NOISE_SIZE - 4)]);
+}
+
+template <typename T>
+inline int lanes(void) {
+	return sizeof(T) / sizeof(float);
+}
+
+template <typename T>
+inline const char *typeName(void) {
+	return lanes<T>() == 1 ? "float" : "float_4";
+}
+
+static int samples = 1 << 20;
+
+/** Runs `step(i)` `samples` times after a warm up pass and prints the cost. */
+template <typename T, typename F>
+void bench(const char *name, const char *path, F step) {
+	for (int i = 0; i < samples / 16; i++) {
+		step(i);
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < samples; i++) {
+		step(i);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+	printf("%-22s %-8s %-14s %9.2f %9.2f\n", name, typeName<T>(), path, ns, ns / lanes<T>());
+}
+
+template <typename T>
+void benchTyped(void) {
+
+	{
+		ZDFSVF<T> filter;
+		filter.setParams(T(.1f), T(.5f));
+		bench<T>("ZDFSVF", "setParams", [&](int i) {
+			filter.setParams(T(.01f) + magnitude(noiseAt<T>(i)) * T(.4f), T(.5f));
+			keep(filter);
+		});
+		bench<T>("ZDFSVF", "process", [&](int i) {
+			filter.process(noiseAt<T>(i));
+			sink = lane0(filter.lpOut);
+		});
+	}
+
+	{
+		JOSSVF<T> filter;
+		bench<T>("JOSSVF", "process", [&](int i) {
+			filter.process(.5f, .75f, noiseAt<T>(i), 0.f, 0.f, 0.f);
+			sink = lane0(filter.lpOut);
+		});
+	}
+
+	{
+		ZenerClipperBL<T> clipper;
+		bench<T>("ZenerClipperBL", "process", [&](int i) {
+			sink = lane0(clipper.process(noiseAt<T>(i) * T(2.f)));
+		});
+	}
+
+	{
+		PeakFollower<T> follower;
+		bench<T>("PeakFollower", "setTimes", [&](int i) {
+			follower.setTimes(.001f + .5f * std::fabs(noise[i & (BENCH_NOISE_SIZE - 1)]), .5f);
+			keep(follower);
+		});
+		follower.setTimes(.01f, .5f);
+		bench<T>("PeakFollower", "process", [&](int i) {
+			sink = lane0(follower.process(noiseAt<T>(i)));
+		});
+	}
+
+	bench<T>("approxExp2_taylor5", "process", [&](int i) {
+		sink = lane0(dsp::approxExp2_taylor5(noiseAt<T>(i) * T(10.f)));
+	});
+
+	bench<T>("voltsToNormal", "standard", [&](int i) {
+		sink = lane0(voltsToNormal(noiseAt<T>(i) * T(10.f), 480.f, -10.f, 10.f, 1.f / 48000.f));
+	});
+
+	bench<T>("normalToG", "eco", [&](int i) {
+		sink = lane0(normalToG<PITCH_ECO>(magnitude(noiseAt<T>(i)) * T(.49f)));
+	});
+
+	bench<T>("normalToG", "standard", [&](int i) {
+		sink = lane0(normalToG<PITCH_STANDARD>(magnitude(noiseAt<T>(i)) * T(.49f)));
+	});
+
+	bench<T>("normalToG", "high", [&](int i) {
+		sink = lane0(normalToG<PITCH_HIGH>(magnitude(noiseAt<T>(i)) * T(.49f)));
+	});
+
+}
+
+void benchScalarOnly(void) {
+
+	{
+		ZDFPhaser4 phaser;
+		bench<float>("ZDFPhaser4", "setParams", [&](int i) {
+			phaser.setParams(.01f + std::fabs(noise[i & (BENCH_NOISE_SIZE - 1)]) * .3f, .3f);
+			keep(phaser);
+		});
+		bench<float>("ZDFPhaser4", "process", [&](int i) {
+			sink = phaser.process(noise[i & (BENCH_NOISE_SIZE - 1)]);
+		});
+	}
+
+	{
+		ZDFPhaser8 phaser;
+		bench<float>("ZDFPhaser8", "setParams", [&](int i) {
+			phaser.setParams(.01f + std::fabs(noise[i & (BENCH_NOISE_SIZE - 1)]) * .3f, .3f);
+			keep(phaser);
+		});
+		bench<float>("ZDFPhaser8", "process", [&](int i) {
+			sink = phaser.process(noise[i & (BENCH_NOISE_SIZE - 1)]);
+		});
+	}
+
+	{
+		StereoPhaser<4> phaser;
+		bench<float_4>("StereoPhaser<4>", "setParams", [&](int i) {
+			float normal = .01f + std::fabs(noise[i & (BENCH_NOISE_SIZE - 1)]) * .3f;
+			phaser.setParams(normal, normal, .3f);
+			sink = phaser.coefficients.loop[0];
+		});
+		bench<float_4>("StereoPhaser<4>", "process", [&](int i) {
+			sink = phaser.process(noiseAt<float_4>(i))[0];
+		});
+	}
+
+	{
+		StereoPhaser<8> phaser;
+		bench<float_4>("StereoPhaser<8>", "setParams", [&](int i) {
+			float normal = .01f + std::fabs(noise[i & (BENCH_NOISE_SIZE - 1)]) * .3f;
+			phaser.setParams(normal, normal, .3f);
+			sink = phaser.coefficients.loop[0];
+		});
+		bench<float_4>("StereoPhaser<8>", "process", [&](int i) {
+			sink = phaser.process(noiseAt<float_4>(i))[0];
+		});
+	}
+
+	{
+		BBD<float> bbd;
+		bench<float>("BBD", "reformFilters", [&](int i) {
+			// 4x oversampled, the engine rate wandering around 48 kHz so no call repeats the last one's work
+			bbd.reformFilters(1.f / (4.f * (48000.f + 4000.f * noise[i & (BENCH_NOISE_SIZE - 1)])));
+			keep(bbd);
+		});
+		bench<float>("BBD", "process", [&](int i) {
+			sink = bbd.process(noise[i & (BENCH_NOISE_SIZE - 1)], 14000.f);
+		});
+	}
+
+	bench<float_4>("bhaskaraSine", "process", [&](int i) {
+		sink = bhaskaraSine<float_4, int32_4>(noiseAt<float_4>(i))[0];
+	});
+
+}
+
+/** Worst and mean relative error of `approx` against `exact` over [lo, hi]. */
+template <typename A, typename E>
+void accuracy(const char *name, float lo, float hi, bool relative, A approx, E exact) {
+	const int points = 100000;
+	double worst = 0.0;
+	double worstAt = lo;
+	double total = 0.0;
+	for (int i = 0; i <= points; i++) {
+		float x = lo + (hi - lo) * i / points;
+		double e = exact(x);
+		double error = std::fabs(approx(x) - e);
+		if (relative) {
+			error /= std::fabs(e) > 1e-12 ? std::fabs(e) : 1.0;
+		}
+		total += error;
+		if (error > worst) {
+			worst = error;
+			worstAt = x;
+		}
+	}
+	printf("%-36s [%6.2f, %6.2f] %-8s %12.3e %12.3e   at %g\n", name, lo, hi, relative ? "rel" : "abs", worst, total / (points + 1), worstAt);
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--samples" && i + 1 < argc) {
+			samples = std::max(1024, atoi(argv[++i]));
+		}
+	}
+
+	uint32_t state = 1;
+	for (int i = 0; i < BENCH_NOISE_SIZE; i++) {
+		state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+		noise[i] = (int32_t) state / 2147483648.f;
+	}
+
+	printf("%d samples per measurement\n\n", samples);
+	printf("%-22s %-8s %-14s %9s %9s\n", "primitive", "type", "path", "ns/call", "ns/voice");
+	benchTyped<float>();
+	benchTyped<float_4>();
+	benchScalarOnly();
+
+	printf("\n%-36s %-16s %-8s %12s %12s\n", "approximation", "range", "error", "worst", "mean");
+	accuracy("approxExp2_taylor5", -10.f, 10.f, true,
+		[](float x) { return dsp::approxExp2_taylor5(x); },
+		[](float x) { return std::exp2((double) x); });
+	accuracy("approxExp2_taylor5, lifted by 10", -10.f, 10.f, true,
+		[](float x) { return dsp::approxExp2_taylor5(x + 10.f) / 1024.f; },
+		[](float x) { return std::exp2((double) x); });
+	accuracy("bhaskaraSine vs sin(pi x)", -1.f, 1.f, false,
+		[](float x) { return bhaskaraSine<float_4, int32_4>(float_4(x))[0]; },
+		[](float x) { return std::sin(M_PI * x); });
+	accuracy("normalToG eco vs tan(pi f)", 0.f, .25f, true,
+		[](float f) { return normalToG<PITCH_ECO>(f); },
+		[](float f) { return std::tan(M_PI * f); });
+	accuracy("normalToG eco vs tan(pi f)", 0.f, .49f, true,
+		[](float f) { return normalToG<PITCH_ECO>(f); },
+		[](float f) { return std::tan(M_PI * f); });
+	accuracy("normalToG standard vs tan(pi f)", 0.f, .49f, true,
+		[](float f) { return normalToG<PITCH_STANDARD>(f); },
+		[](float f) { return std::tan(M_PI * f); });
+	accuracy("normalToG high vs tan(pi f)", 0.f, .49f, true,
+		[](float f) { return normalToG<PITCH_HIGH>(float_4(f))[0]; },
+		[](float f) { return std::tan(M_PI * f); });
+
+	return 0;
+}
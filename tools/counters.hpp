@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters for the calling thread through perf_event_open, Linux only. The counters are opened
+// as one group so they are scheduled on the PMU together and read back in a single read(). Anywhere the
+// kernel refuses (no PMU in a VM, perf_event_paranoid too high, not Linux) `available` stays false and
+// the tools print n/a instead.
+
+enum CounterIds {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_L1D_MISSES,
+	COUNTER_LLC_MISSES,
+	NUM_COUNTERS
+};
+
+struct CounterValues {
+	uint64_t v[NUM_COUNTERS] = {};
+
+	double ipc(void) const {
+		return v[COUNTER_CYCLES] ? (double) v[COUNTER_INSTRUCTIONS] / v[COUNTER_CYCLES] : 0.0;
+	}
+};
+
+struct HardwareCounters {
+
+	int fds[NUM_COUNTERS];
+	bool available = false;
+
+	HardwareCounters() {
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			fds[i] = -1;
+		}
+#ifdef __linux__
+		const uint32_t types[NUM_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+		const uint64_t configs[NUM_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES
+		};
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			struct perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[i];
+			attr.config = configs[i];
+			attr.disabled = (i == 0);
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+			if (fds[i] < 0) {
+				close();
+				return;
+			}
+		}
+		available = true;
+#endif
+	}
+
+	~HardwareCounters() {
+		close();
+	}
+
+	void close(void) {
+#ifdef __linux__
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			if (fds[i] >= 0) {
+				::close(fds[i]);
+				fds[i] = -1;
+			}
+		}
+#endif
+		available = false;
+	}
+
+	void start(void) {
+#ifdef __linux__
+		if (available) {
+			ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif
+	}
+
+	CounterValues stop(void) {
+		CounterValues values;
+#ifdef __linux__
+		if (available) {
+			ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+			// PERF_FORMAT_GROUP: the number of counters, then one value each in the order they were opened
+			uint64_t buffer[1 + NUM_COUNTERS];
+			if (read(fds[0], buffer, sizeof(buffer)) == (ssize_t) sizeof(buffer)) {
+				for (int i = 0; i < NUM_COUNTERS; i++) {
+					values.v[i] = buffer[1 + i];
+				}
+			}
+		}
+#endif
+		return values;
+	}
+
+};
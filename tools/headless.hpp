@@ -0,0 +1,252 @@
+#pragma once
+
+#include <rack.hpp>
+
+#include "../src/convolver.hpp"
+
+#include <string>
+#include <vector>
+
+// Just enough of Rack to run TRS modules off line. The plugin objects are linked straight into the tool,
+// `init()` registers the models as it would in Rack, and a HeadlessGraph steps the modules and copies
+// cables itself instead of going through the engine's module list.
+
+using namespace rack;
+
+/** Audio files are scaled to Rack's 10 Vpp on the way in and back to full scale on the way out. */
+#define HEADLESS_VOLTS 5.f
+
+/** There is no UI thread here to start a module's loads and serve its allocations, so a tool calls this whenever
+ *  Rack's UI would have run: after loading settings and after a rate change, never inside process(). */
+inline void finishLoading(engine::Module *module) {
+	ConvolutionHost *host = dynamic_cast<ConvolutionHost *>(module);
+	if (host) {
+		host->convolutionLoader()->finish();
+	}
+}
+
+/** Hands a convolution module a decaying noise response `seconds` long, built in memory at `rate`, so its wet
+ *  path runs without an IR file. Other modules are left alone. */
+inline void installTestResponse(engine::Module *module, float rate, float seconds) {
+	ConvolutionHost *host = dynamic_cast<ConvolutionHost *>(module);
+	if (!host) {
+		return;
+	}
+	std::vector<dsp::Frame<2>> frames(std::max(1, (int) (seconds * rate)));
+	float gain = 1.f / std::sqrt((float) frames.size());
+	uint32_t state = 1;
+	for (size_t i = 0; i < frames.size(); i++) {
+		// -60 dB by the end
+		float decay = gain * std::exp(-6.9f * i / frames.size());
+		for (int side = 0; side < 2; side++) {
+			state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+			frames[i].samples[side] = decay * (int32_t) state / 2147483648.f;
+		}
+	}
+	host->convolutionLoader()->install(ConvolutionEngine::build(frames, true, rate));
+}
+
+struct HeadlessRack {
+
+	Context *context = NULL;
+	plugin::Plugin *plugin = NULL;
+
+	void start(float sampleRate) {
+		// dev mode keeps Rack's user folder and log in the working directory
+		settings::devMode = true;
+		asset::init();
+		logger::init();
+
+		context = new Context;
+		contextSet(context);
+		context->engine = new engine::Engine;
+		context->engine->setSampleRate(sampleRate);
+
+		plugin = new plugin::Plugin;
+		plugin->slug = "TRS";
+		init(plugin);
+	}
+
+	void stop(void) {
+		// the models belong to the plugin, the engine to the context
+		delete plugin;
+		delete context;
+		contextSet(NULL);
+		logger::destroy();
+	}
+
+	/** APP is per thread, a worker has to attach before it creates or runs modules. */
+	void attachThread(void) {
+		contextSet(context);
+	}
+
+	plugin::Model *findModel(std::string slug) {
+		for (plugin::Model *model : plugin->models) {
+			if (model->slug == slug) {
+				return model;
+			}
+		}
+		return NULL;
+	}
+
+};
+
+struct HeadlessGraph {
+
+	struct Node {
+		std::string id;
+		engine::Module *module;
+	};
+
+	struct Cable {
+		engine::Output *from;
+		engine::Input *to;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Cable> cables;
+
+	/** Patched from "input" in the graph, carries the file as TRS stereo on channels 0 and 8. */
+	engine::Output source;
+	/** Patched to "output" in the graph, read back the same way. */
+	engine::Input sink;
+
+	engine::Module::ProcessArgs args;
+
+	HeadlessGraph() {
+		args.frame = 0;
+		source.setChannels(16);
+	}
+
+	~HeadlessGraph() {
+		for (Node &node : nodes) {
+			delete node.module;
+		}
+	}
+
+	engine::Module *findModule(std::string id) {
+		for (Node &node : nodes) {
+			if (node.id == id) {
+				return node.module;
+			}
+		}
+		return NULL;
+	}
+
+	/**
+	 *  {"modules": [{"id": "vcf", "model": "TRSVCF", "params": [0.5, 0.2], "data": {...}}, ...],
+	 *   "cables": [{"from": ["input"], "to": ["vcf", 3]}, {"from": ["vcf", 2], "to": ["output"]}, ...]}
+	 *  Ports and params are numbered as in each module's enums, "data" is handed to dataFromJson().
+	 */
+	bool load(json_t *rootJ, HeadlessRack *rack, std::string *error) {
+		json_t *modulesJ = json_object_get(rootJ, "modules");
+		json_t *cablesJ = json_object_get(rootJ, "cables");
+		if (!json_is_array(modulesJ) || !json_is_array(cablesJ)) {
+			*error = "graph needs a \"modules\" and a \"cables\" array";
+			return false;
+		}
+
+		size_t i;
+		json_t *moduleJ;
+		json_array_foreach(modulesJ, i, moduleJ) {
+			const char *id = json_string_value(json_object_get(moduleJ, "id"));
+			const char *slug = json_string_value(json_object_get(moduleJ, "model"));
+			plugin::Model *model = slug ? rack->findModel(slug) : NULL;
+			if (!id || !model) {
+				*error = string::f("module %d has no id or an unknown model", (int) i);
+				return false;
+			}
+			engine::Module *module = model->createModule();
+			nodes.push_back({id, module});
+
+			size_t p;
+			json_t *paramJ;
+			json_array_foreach(json_object_get(moduleJ, "params"), p, paramJ) {
+				if (p < module->params.size()) {
+					module->params[p].setValue(json_number_value(paramJ));
+				}
+			}
+
+			json_t *dataJ = json_object_get(moduleJ, "data");
+			if (dataJ) {
+				module->dataFromJson(dataJ);
+			}
+			finishLoading(module);
+		}
+
+		json_t *cableJ;
+		json_array_foreach(cablesJ, i, cableJ) {
+			Cable cable;
+			cable.from = findOutput(json_object_get(cableJ, "from"));
+			cable.to = findInput(json_object_get(cableJ, "to"));
+			if (!cable.from || !cable.to) {
+				*error = string::f("cable %d has an unknown end", (int) i);
+				return false;
+			}
+			cables.push_back(cable);
+		}
+
+		return true;
+	}
+
+	static std::string endId(json_t *endJ) {
+		const char *id = json_string_value(json_array_get(endJ, 0));
+		return id ? id : "";
+	}
+
+	engine::Output *findOutput(json_t *endJ) {
+		std::string id = endId(endJ);
+		if (id == "input") {
+			return &source;
+		}
+		engine::Module *module = findModule(id);
+		size_t port = json_integer_value(json_array_get(endJ, 1));
+		return (module && port < module->outputs.size()) ? &module->outputs[port] : NULL;
+	}
+
+	engine::Input *findInput(json_t *endJ) {
+		std::string id = endId(endJ);
+		if (id == "output") {
+			return &sink;
+		}
+		engine::Module *module = findModule(id);
+		size_t port = json_integer_value(json_array_get(endJ, 1));
+		return (module && port < module->inputs.size()) ? &module->inputs[port] : NULL;
+	}
+
+	void setSampleRate(float sampleRate) {
+		args.sampleRate = sampleRate;
+		args.sampleTime = 1.f / sampleRate;
+		for (Node &node : nodes) {
+			node.module->onSampleRateChange();
+		}
+	}
+
+	/** After setSampleRate(), outside anything timed or checked: waits for the loads the rate change started. */
+	void finishLoading(void) {
+		for (Node &node : nodes) {
+			::finishLoading(node.module);
+		}
+	}
+
+	/** One engine frame: every module in file order, then every cable, so each cable is one sample late as in Rack. */
+	inline void process(float left, float right, float *outLeft, float *outRight) {
+		source.setVoltage(left * HEADLESS_VOLTS, 0);
+		source.setVoltage(right * HEADLESS_VOLTS, 8);
+
+		for (Node &node : nodes) {
+			node.module->process(args);
+		}
+
+		for (Cable &cable : cables) {
+			cable.to->channels = cable.from->channels;
+			std::memcpy(cable.to->voltages, cable.from->voltages, cable.from->channels * sizeof(float));
+		}
+
+		*outLeft = sink.getPolyVoltage(0) / HEADLESS_VOLTS;
+		*outRight = sink.getPolyVoltage(8) / HEADLESS_VOLTS;
+
+		args.frame++;
+	}
+
+};
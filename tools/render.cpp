@@ -0,0 +1,44 @@
+#include "render.hpp"
+
+#include <chrono>
+
+// trs-render graph.json in.wav out.wav
+// Streams a WAV file through a graph of TRS modules as fast as the CPU allows and reports the real time factor.
+
+int main(int argc, char **argv) {
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s graph.json in.wav out.wav\n", argv[0]);
+		return 1;
+	}
+
+	HeadlessRack rack;
+	rack.start(44100.f);
+
+	std::string error;
+	int64_t frames = -1;
+	double seconds = 0.0;
+
+	json_t *rootJ = loadGraphJson(argv[1], &error);
+	if (rootJ) {
+		HeadlessGraph graph;
+		if (graph.load(rootJ, &rack, &error)) {
+			auto start = std::chrono::steady_clock::now();
+			frames = renderWav(&graph, argv[2], argv[3], &error);
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		json_decref(rootJ);
+	}
+
+	if (frames < 0) {
+		fprintf(stderr, "%s\n", error.c_str());
+		rack.stop();
+		return 1;
+	}
+
+	double audioSeconds = frames / (double) APP->engine->getSampleRate();
+	printf("%lld frames, %.2f s of audio in %.3f s, %.1fx real time\n",
+		(long long) frames, audioSeconds, seconds, seconds > 0.0 ? audioSeconds / seconds : 0.0);
+
+	rack.stop();
+	return 0;
+}
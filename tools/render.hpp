@@ -0,0 +1,149 @@
+#pragma once
+
+#include "headless.hpp"
+#include "../src/wav.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File side of the off line renderer. Both files are mapped rather than read, and the graph is fed
+// one block at a time: a block of frames is decoded into floats, run through the graph and encoded
+// into the output mapping, so memory use does not grow with the length of the file.
+
+#define RENDER_BLOCK_SIZE 1024
+
+struct MappedFile {
+
+	int fd = -1;
+	uint8_t *data = NULL;
+	size_t size = 0;
+
+	bool openRead(const char *path) {
+		fd = open(path, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) || st.st_size == 0) {
+			return false;
+		}
+		size = st.st_size;
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		data = (uint8_t *) p;
+		madvise(data, size, MADV_SEQUENTIAL);
+		return true;
+	}
+
+	bool openWrite(const char *path, size_t bytes) {
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, bytes)) {
+			return false;
+		}
+		size = bytes;
+		void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		data = (uint8_t *) p;
+		madvise(data, size, MADV_SEQUENTIAL);
+		return true;
+	}
+
+	~MappedFile() {
+		if (data) {
+			munmap(data, size);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+};
+
+/** Runs `inPath` through `graph` into a stereo float file at `outPath`, returns the number of frames or -1. */
+inline int64_t renderWav(HeadlessGraph *graph, const char *inPath, const char *outPath, std::string *error) {
+	MappedFile in;
+	WavInfo info;
+	if (!in.openRead(inPath) || !parseWav(in.data, in.size, &info)) {
+		*error = string::f("could not read %s as a WAV file", inPath);
+		return -1;
+	}
+
+	MappedFile out;
+	if (!out.openWrite(outPath, WAV_HEADER_SIZE + info.frames * 2 * sizeof(float))) {
+		*error = string::f("could not create %s", outPath);
+		return -1;
+	}
+	writeWavHeader(out.data, 2, info.sampleRate, info.frames);
+
+	// modules read the rate back from APP->engine, so the engine has to agree with the file
+	if (APP->engine->getSampleRate() != info.sampleRate) {
+		APP->engine->setSampleRate(info.sampleRate);
+	}
+	graph->setSampleRate(info.sampleRate);
+	graph->finishLoading();
+
+	int sampleBytes = info.bitsPerSample / 8;
+	const uint8_t *frame = in.data + info.dataOffset;
+	// mono files go to both sides, anything past the first two channels is ignored
+	int rightOffset = (info.channels > 1) ? sampleBytes : 0;
+
+	float inBlock[RENDER_BLOCK_SIZE][2];
+	float outBlock[RENDER_BLOCK_SIZE][2];
+
+	for (size_t start = 0; start < info.frames; start += RENDER_BLOCK_SIZE) {
+		int length = std::min((size_t) RENDER_BLOCK_SIZE, info.frames - start);
+
+		for (int i = 0; i < length; i++) {
+			inBlock[i][0] = wavSample(frame, info);
+			inBlock[i][1] = wavSample(frame + rightOffset, info);
+			frame += info.bytesPerFrame();
+		}
+
+		for (int i = 0; i < length; i++) {
+			graph->process(inBlock[i][0], inBlock[i][1], &outBlock[i][0], &outBlock[i][1]);
+		}
+
+		std::memcpy(out.data + WAV_HEADER_SIZE + start * 2 * sizeof(float), outBlock, length * 2 * sizeof(float));
+	}
+
+	return info.frames;
+}
+
+/** Drives `graph` with white noise for `frames` frames and discards the output, returns a sum so none of it is optimised away. */
+inline float renderNoise(HeadlessGraph *graph, int64_t frames, uint32_t seed) {
+	uint32_t state = seed ? seed : 1;
+	float sum = 0.f;
+	for (int64_t i = 0; i < frames; i++) {
+		// xorshift, two draws per frame
+		state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+		float left = (int32_t) state / 2147483648.f;
+		state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+		float right = (int32_t) state / 2147483648.f;
+		float outLeft, outRight;
+		graph->process(left, right, &outLeft, &outRight);
+		sum += outLeft + outRight;
+	}
+	return sum;
+}
+
+/** Sample rate from a WAV header without reading the file, 0 if it is not one. */
+inline int wavSampleRate(const char *path) {
+	MappedFile file;
+	WavInfo info;
+	if (!file.openRead(path) || !parseWav(file.data, file.size, &info)) {
+		return 0;
+	}
+	return info.sampleRate;
+}
+
+inline json_t *loadGraphJson(const char *path, std::string *error) {
+	json_error_t jsonError;
+	json_t *rootJ = json_load_file(path, 0, &jsonError);
+	if (!rootJ) {
+		*error = string::f("%s:%d: %s", path, jsonError.line, jsonError.text);
+	}
+	return rootJ;
+}
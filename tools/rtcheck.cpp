@@ -0,0 +1,508 @@
+#include "headless.hpp"
+#include "render.hpp"
+
+#include <cerrno>
+#include <cstdarg>
+#include <map>
+#include <new>
+
+#if defined(__GLIBC__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+// trs-rtcheck [--models A,B,...] [--frames N] [--rates 44100,48000,96000] [--graph graph.json]
+// Proves the audio path stays real time safe. This binary replaces malloc and friends, operator new and
+// delete, the pthread locks and waits, and the sleeping and file syscalls, and every replacement checks
+// whether its thread is inside a TRS process() or onSampleRateChange() call. One that is gets reported with
+// the module, the call and a backtrace, and the tool exits non zero. Everything the UI thread would do in
+// Rack (creating modules, moving knobs, loading JSON) happens outside the checked region.
+//
+// Each model is driven through its inputs unpatched, mono and full TRS stereo, at every sample rate. Twice in
+// every pass the params are randomized and the module's saved settings (block size, quality tier, oversampling,
+// mode, stage order, pole count) are posted back through dataFromJson() with new values, so the config
+// mailboxes, switch crossfades and BlockBuffer resizes all run inside the checked region. TRSCONV is given a
+// response built in memory at each rate, so it convolves rather than passing its input through. `--graph`
+// checks a trs-render graph as a whole instead.
+//
+// Built by `make TRS_RT_CHECK=1 tools`, which also keeps frame pointers and exports symbols so the
+// backtraces are readable. Interposing relies on glibc's __libc_* entry points, so Linux only.
+
+#if defined(__GLIBC__)
+
+/** Non NULL while this thread is inside checked module code, names the module and call. */
+static thread_local const char *audioScope = NULL;
+/** Set while a report is being recorded, so the checker's own allocations are not reported. */
+static thread_local bool reporting = false;
+
+struct Violation {
+	std::string kind;
+	std::string where;
+	std::vector<void *> frames;
+	int count;
+};
+
+#define RTCHECK_FRAMES 24
+
+static std::map<std::string, Violation> *violations = NULL;
+static pthread_mutex_t violationsLock = PTHREAD_MUTEX_INITIALIZER;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+}
+
+static void report(const char *kind) {
+	if (!audioScope || reporting) {
+		return;
+	}
+	reporting = true;
+
+	void *frames[RTCHECK_FRAMES];
+	// skip report() and the hook itself
+	int depth = backtrace(frames, RTCHECK_FRAMES);
+	std::vector<void *> stack(frames + std::min(depth, 2), frames + depth);
+
+	std::string key = string::f("%s %s", kind, audioScope);
+	for (void *frame : stack) {
+		key += string::f(" %p", frame);
+	}
+
+	pthread_mutex_lock(&violationsLock);
+	if (!violations) {
+		violations = new std::map<std::string, Violation>;
+	}
+	auto found = violations->find(key);
+	if (found == violations->end()) {
+		violations->insert(std::make_pair(key, Violation {kind, audioScope, stack, 1}));
+	} else {
+		found->second.count++;
+	}
+	pthread_mutex_unlock(&violationsLock);
+
+	reporting = false;
+}
+
+/** The next definition of NAME after this binary's, looked up once. */
+#define RTCHECK_NEXT(TYPE, NAME) \
+	static TYPE next = NULL; \
+	if (!next) { \
+		next = (TYPE) dlsym(RTLD_NEXT, NAME); \
+	}
+
+extern "C" {
+
+void *malloc(size_t size) {
+	report("malloc");
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	report("calloc");
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+	report("realloc");
+	return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+	if (pointer) {
+		report("free");
+	}
+	__libc_free(pointer);
+}
+
+void *memalign(size_t alignment, size_t size) {
+	report("memalign");
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	report("aligned_alloc");
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) {
+	report("posix_memalign");
+	*pointer = __libc_memalign(alignment, size);
+	return *pointer ? 0 : ENOMEM;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+	report("pthread_mutex_lock");
+	RTCHECK_NEXT(int (*)(pthread_mutex_t *), "pthread_mutex_lock");
+	return next(mutex);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *lock) {
+	report("pthread_rwlock_rdlock");
+	RTCHECK_NEXT(int (*)(pthread_rwlock_t *), "pthread_rwlock_rdlock");
+	return next(lock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *lock) {
+	report("pthread_rwlock_wrlock");
+	RTCHECK_NEXT(int (*)(pthread_rwlock_t *), "pthread_rwlock_wrlock");
+	return next(lock);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+	report("pthread_cond_wait");
+	RTCHECK_NEXT(int (*)(pthread_cond_t *, pthread_mutex_t *), "pthread_cond_wait");
+	return next(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *until) {
+	report("pthread_cond_timedwait");
+	RTCHECK_NEXT(int (*)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *), "pthread_cond_timedwait");
+	return next(cond, mutex, until);
+}
+
+int sem_wait(sem_t *semaphore) {
+	report("sem_wait");
+	RTCHECK_NEXT(int (*)(sem_t *), "sem_wait");
+	return next(semaphore);
+}
+
+int nanosleep(const struct timespec *duration, struct timespec *remaining) {
+	report("nanosleep");
+	RTCHECK_NEXT(int (*)(const struct timespec *, struct timespec *), "nanosleep");
+	return next(duration, remaining);
+}
+
+int usleep(useconds_t microseconds) {
+	report("usleep");
+	RTCHECK_NEXT(int (*)(useconds_t), "usleep");
+	return next(microseconds);
+}
+
+ssize_t read(int fd, void *buffer, size_t size) {
+	report("read");
+	RTCHECK_NEXT(ssize_t (*)(int, void *, size_t), "read");
+	return next(fd, buffer, size);
+}
+
+ssize_t write(int fd, const void *buffer, size_t size) {
+	report("write");
+	RTCHECK_NEXT(ssize_t (*)(int, const void *, size_t), "write");
+	return next(fd, buffer, size);
+}
+
+int open(const char *path, int flags, ...) {
+	report("open");
+	mode_t mode = 0;
+	if (flags & O_CREAT) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	RTCHECK_NEXT(int (*)(const char *, int, ...), "open");
+	return next(path, flags, mode);
+}
+
+FILE *fopen(const char *path, const char *mode) {
+	report("fopen");
+	RTCHECK_NEXT(FILE *(*)(const char *, const char *), "fopen");
+	return next(path, mode);
+}
+
+int poll(struct pollfd *fds, nfds_t count, int timeout) {
+	report("poll");
+	RTCHECK_NEXT(int (*)(struct pollfd *, nfds_t, int), "poll");
+	return next(fds, count, timeout);
+}
+
+}
+
+// operator new and delete would reach malloc and free anyway, replacing them names the C++ call in the report
+
+void *operator new(size_t size) {
+	report("operator new");
+	void *pointer = __libc_malloc(size ? size : 1);
+	if (!pointer) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void *operator new[](size_t size) {
+	report("operator new[]");
+	void *pointer = __libc_malloc(size ? size : 1);
+	if (!pointer) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	report("operator new");
+	return __libc_malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	report("operator new[]");
+	return __libc_malloc(size ? size : 1);
+}
+
+void operator delete(void *pointer) noexcept {
+	if (pointer) {
+		report("operator delete");
+	}
+	__libc_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+	if (pointer) {
+		report("operator delete[]");
+	}
+	__libc_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+	operator delete(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+	operator delete[](pointer);
+}
+
+/** Runs `f` as checked module code, reports name it `where`. */
+template <typename F>
+static void checked(const char *where, F f) {
+	audioScope = where;
+	f();
+	audioScope = NULL;
+}
+
+static std::string demangle(const char *symbol) {
+	// glibc gives "binary(mangled+0x12) [0x...]"
+	std::string text = symbol;
+	size_t open = text.find('(');
+	size_t plus = text.find('+', open);
+	if (open == std::string::npos || plus == std::string::npos || plus == open + 1) {
+		return text;
+	}
+	std::string mangled = text.substr(open + 1, plus - open - 1);
+	int status = 0;
+	char *name = abi::__cxa_demangle(mangled.c_str(), NULL, NULL, &status);
+	if (status != 0 || !name) {
+		return text;
+	}
+	std::string result = name + text.substr(plus);
+	std::free(name);
+	return result;
+}
+
+static uint32_t noiseState = 1;
+
+static float noise(void) {
+	noiseState ^= noiseState << 13; noiseState ^= noiseState >> 17; noiseState ^= noiseState << 5;
+	return 5.f * (int32_t) noiseState / 2147483648.f;
+}
+
+/** Sets `key` only where the module saves it, so each module is only handed its own settings. */
+static void setSaved(json_t *dataJ, const char *key, int value) {
+	if (json_object_get(dataJ, key)) {
+		json_object_set_new(dataJ, key, json_integer(value));
+	}
+}
+
+/** What the UI thread does between passes: knobs move and every saved setting is posted with the value for `pass`. */
+static void touch(engine::Module *module, int pass) {
+	for (size_t p = 0; p < module->params.size(); p++) {
+		engine::ParamQuantity *quantity = module->paramQuantities[p];
+		float t = .5f + .5f * noise() / 5.f;
+		module->params[p].setValue(quantity ? quantity->getMinValue() + t * (quantity->getMaxValue() - quantity->getMinValue()) : t);
+	}
+	json_t *dataJ = module->dataToJson();
+	if (dataJ) {
+		const int blockSizes[] = {0, 16, 64};
+		// 0 follows the engine rate, then each fixed factor
+		const int oversample[] = {0, 1, 2, 4, 8};
+		setSaved(dataJ, "blockSize", blockSizes[pass % 3]);
+		// the plugin wide tier, then eco, standard and high
+		setSaved(dataJ, "quality", pass % 4 - 1);
+		setSaved(dataJ, "oversample", oversample[pass % 5]);
+		setSaved(dataJ, "mode", pass % 4);
+		setSaved(dataJ, "order", (pass + 1) % 4);
+		setSaved(dataJ, "poles", pass % 2);
+		module->dataFromJson(dataJ);
+		json_decref(dataJ);
+	}
+}
+
+static void checkModel(plugin::Model *model, const std::vector<float> &rates, int frames) {
+	std::string processScope = model->slug + "::process";
+	std::string rateScope = model->slug + "::onSampleRateChange";
+
+	engine::Module *module = model->createModule();
+	engine::Module::ProcessArgs args;
+	args.frame = 0;
+
+	// unpatched, mono, then TRS stereo on every input
+	const int channels[] = {0, 1, 16};
+	int pass = 0;
+
+	for (float rate : rates) {
+		APP->engine->setSampleRate(rate);
+		engine::Module::SampleRateChangeEvent e;
+		e.sampleRate = rate;
+		e.sampleTime = 1.f / rate;
+		checked(rateScope.c_str(), [&]() {
+			module->onSampleRateChange(e);
+		});
+		finishLoading(module);
+		// a new response at every rate, so the first pass also swaps engines inside the checked region
+		installTestResponse(module, rate, .25f);
+		args.sampleRate = rate;
+		args.sampleTime = 1.f / rate;
+
+		for (int c : channels) {
+			for (engine::Input &input : module->inputs) {
+				input.channels = c;
+			}
+
+			// the second touch lands on a module that is already running, so its switches crossfade
+			for (int half = 0; half < 2; half++) {
+				touch(module, pass++);
+				finishLoading(module);
+
+				checked(processScope.c_str(), [&]() {
+					for (int i = 0; i < frames / 2; i++, args.frame++) {
+						for (engine::Input &input : module->inputs) {
+							for (int v = 0; v < input.channels; v++) {
+								input.voltages[v] = noise();
+							}
+						}
+						module->process(args);
+					}
+				});
+			}
+		}
+	}
+
+	delete module;
+}
+
+static bool checkGraph(HeadlessRack *rack, const char *path, const std::vector<float> &rates, int frames) {
+	std::string error;
+	json_t *rootJ = loadGraphJson(path, &error);
+	HeadlessGraph graph;
+	bool loaded = rootJ && graph.load(rootJ, rack, &error);
+	if (rootJ) {
+		json_decref(rootJ);
+	}
+	if (!loaded) {
+		fprintf(stderr, "%s: %s\n", path, error.c_str());
+		return false;
+	}
+
+	for (float rate : rates) {
+		APP->engine->setSampleRate(rate);
+		checked("graph onSampleRateChange", [&]() {
+			graph.setSampleRate(rate);
+		});
+		graph.finishLoading();
+		checked("graph process", [&]() {
+			renderNoise(&graph, frames, noiseState);
+		});
+	}
+	return true;
+}
+
+static std::vector<float> parseRates(const char *text) {
+	std::vector<float> rates;
+	for (const std::string &part : string::split(text, ",")) {
+		rates.push_back(std::max(1000.f, (float) atof(part.c_str())));
+	}
+	return rates;
+}
+
+int main(int argc, char **argv) {
+	std::vector<std::string> slugs;
+	std::vector<float> rates = {44100.f, 48000.f, 96000.f};
+	int frames = 1 << 14;
+	const char *graphPath = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--models" && i + 1 < argc) {
+			slugs = string::split(argv[++i], ",");
+		} else if (arg == "--rates" && i + 1 < argc) {
+			rates = parseRates(argv[++i]);
+		} else if (arg == "--frames" && i + 1 < argc) {
+			frames = std::max(64, atoi(argv[++i]));
+		} else if (arg == "--graph" && i + 1 < argc) {
+			graphPath = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--models A,B,...] [--frames N] [--rates 44100,...] [--graph graph.json]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	HeadlessRack rack;
+	rack.start(rates[0]);
+
+	if (graphPath) {
+		if (!checkGraph(&rack, graphPath, rates, frames)) {
+			rack.stop();
+			return 1;
+		}
+	} else {
+		std::vector<plugin::Model *> models;
+		for (const std::string &slug : slugs) {
+			plugin::Model *model = rack.findModel(slug);
+			if (!model) {
+				fprintf(stderr, "unknown model %s\n", slug.c_str());
+				rack.stop();
+				return 1;
+			}
+			models.push_back(model);
+		}
+		if (slugs.empty()) {
+			models = std::vector<plugin::Model *>(rack.plugin->models.begin(), rack.plugin->models.end());
+		}
+		for (plugin::Model *model : models) {
+			checkModel(model, rates, frames);
+			printf("%-16s checked\n", model->slug.c_str());
+		}
+	}
+
+	rack.stop();
+
+	size_t count = violations ? violations->size() : 0;
+	printf("\n%zu distinct violation%s\n", count, count == 1 ? "" : "s");
+	if (!count) {
+		return 0;
+	}
+	for (auto &entry : *violations) {
+		const Violation &v = entry.second;
+		printf("\n%s in %s, %d time%s\n", v.kind.c_str(), v.where.c_str(), v.count, v.count == 1 ? "" : "s");
+		char **symbols = backtrace_symbols(v.frames.data(), v.frames.size());
+		for (size_t f = 0; f < v.frames.size(); f++) {
+			printf("    %s\n", symbols ? demangle(symbols[f]).c_str() : "?");
+		}
+		std::free(symbols);
+	}
+	return 1;
+}
+
+#else
+
+int main(int argc, char **argv) {
+	fprintf(stderr, "%s: the real time checker interposes glibc and only runs on Linux\n", argv[0]);
+	return 1;
+}
+
+#endif
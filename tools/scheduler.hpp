@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Work stealing pool for the batch renderer. Every worker owns a deque, takes its own work from the back
+// and, once that runs dry, steals from the front of a random victim. Renders are long and uneven in length,
+// so the point is to keep every core busy to the end of the batch rather than to shave scheduling overhead.
+
+struct WorkerStats {
+	int jobs = 0;
+	int steals = 0;
+	double busySeconds = 0.0;
+	// keeps each worker's counters on their own cache line
+	char pad[64];
+};
+
+struct WorkStealingPool {
+
+	typedef std::function<void(int worker)> Job;
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<Queue> queues;
+	std::vector<WorkerStats> stats;
+	std::atomic<int> remaining {0};
+
+	WorkStealingPool(int workers) : queues(workers), stats(workers) {}
+
+	/** Round robin, so a batch starts out balanced by count and stealing only has to even out the lengths. */
+	void push(Job job) {
+		Queue &queue = queues[remaining.load() % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+		remaining++;
+	}
+
+	bool popOwn(int worker, Job *job) {
+		Queue &queue = queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) {
+			return false;
+		}
+		*job = queue.jobs.back();
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	bool steal(int worker, std::minstd_rand &rng, Job *job) {
+		int workers = queues.size();
+		int first = rng() % workers;
+		for (int i = 0; i < workers; i++) {
+			int victim = (first + i) % workers;
+			if (victim == worker) {
+				continue;
+			}
+			Queue &queue = queues[victim];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.jobs.empty()) {
+				*job = queue.jobs.front();
+				queue.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(int worker) {
+		std::minstd_rand rng(worker + 1);
+		Job job;
+		while (remaining.load() > 0) {
+			bool stolen = false;
+			if (!popOwn(worker, &job)) {
+				if (!steal(worker, rng, &job)) {
+					std::this_thread::yield();
+					continue;
+				}
+				stolen = true;
+			}
+			auto start = std::chrono::steady_clock::now();
+			job(worker);
+			stats[worker].busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			stats[worker].jobs++;
+			stats[worker].steals += stolen;
+			remaining--;
+		}
+	}
+
+	/** Runs every queued job, `setup` is called on each worker thread before it starts taking work. */
+	void run(std::function<void(int worker)> setup) {
+		std::vector<std::thread> threads;
+		for (int worker = 0; worker < (int) queues.size(); worker++) {
+			threads.emplace_back([this, worker, setup]() {
+				pinToCore(worker);
+				setup(worker);
+				work(worker);
+			});
+		}
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+	}
+
+	/** One worker per core, so the scaling curve measures cores and not the OS scheduler. */
+	static void pinToCore(int core) {
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % std::thread::hardware_concurrency(), &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+
+};
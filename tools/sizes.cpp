@@ -0,0 +1,28 @@
+#include "../src/trs.hpp"
+
+#include <algorithm>
+
+// trs-sizes
+// Lists sizeof for every TRS model next to the budget it declares with TRS_FOOTPRINT(), largest first,
+// and exits non zero when a model has grown past its budget. Budgets are for a plain build, the
+// TRS_PROFILE and TRS_DENORMAL_STATS builds carry extra per module state.
+
+int main(int argc, char **argv) {
+	std::vector<ModuleFootprint> footprints = moduleFootprints();
+	std::sort(footprints.begin(), footprints.end(), [](const ModuleFootprint &a, const ModuleFootprint &b) {
+		return a.size > b.size;
+	});
+
+	printf("%-16s %10s %10s %6s\n", "model", "sizeof", "budget", "used");
+	size_t total = 0;
+	int over = 0;
+	for (const ModuleFootprint &f : footprints) {
+		bool fits = f.size <= f.budget;
+		printf("%-16s %10zu %10zu %5.0f%%%s\n", f.slug, f.size, f.budget, 100.0 * f.size / f.budget, fits ? "" : "  over budget");
+		total += f.size;
+		over += !fits;
+	}
+	printf("%-16s %10zu\n", "one of each", total);
+
+	return over ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "headless.hpp"
+#include "counters.hpp"
+
+#include <chrono>
+
+// trs-stress [--models TRSVCF,TRSBBD,...] [--counts 1,16,64,256,512] [--frames N] [--rate HZ]
+// Instantiates growing populations of each TRS model, and of all of them mixed, and runs every instance
+// round robin once per frame the way Rack's engine does, so the working set grows with the population
+// until it falls out of L1, then L2, then the LLC. Reports ns per instance per frame at each size, and on
+// Linux the IPC and cache misses per instance frame from the hardware counters.
+//
+// Every input of every instance is fed 16 channels of noise each frame, standing in for Rack copying
+// cables, so the modules see real signal and the port traffic is part of the measurement.
+
+#define STRESS_NOISE_FRAMES 4096
+
+static float noise[STRESS_NOISE_FRAMES + 16];
+
+struct Population {
+
+	std::vector<engine::Module *> modules;
+
+	~Population() {
+		for (engine::Module *module : modules) {
+			delete module;
+		}
+	}
+
+	void add(plugin::Model *model) {
+		engine::Module *module = model->createModule();
+		for (engine::Input &input : module->inputs) {
+			input.channels = 16;
+		}
+		module->onSampleRateChange();
+		finishLoading(module);
+		modules.push_back(module);
+	}
+
+	inline void process(const engine::Module::ProcessArgs &args) {
+		const float *frame = &noise[args.frame & (STRESS_NOISE_FRAMES - 1)];
+		for (engine::Module *module : modules) {
+			for (engine::Input &input : module->inputs) {
+				std::memcpy(input.voltages, frame, 16 * sizeof(float));
+			}
+			module->process(args);
+		}
+	}
+
+};
+
+static std::vector<int> parseList(const char *text) {
+	std::vector<int> values;
+	for (const std::string &part : string::split(text, ",")) {
+		values.push_back(std::max(1, atoi(part.c_str())));
+	}
+	return values;
+}
+
+/** Runs `population` for `frames` after a warm up pass and prints one row. */
+static void measure(const char *name, Population *population, int frames, float sampleRate, HardwareCounters *counters) {
+	engine::Module::ProcessArgs args;
+	args.sampleRate = sampleRate;
+	args.sampleTime = 1.f / sampleRate;
+	args.frame = 0;
+
+	for (int i = 0; i < frames / 8; i++, args.frame++) {
+		population->process(args);
+	}
+
+	counters->start();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++, args.frame++) {
+		population->process(args);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	CounterValues values = counters->stop();
+
+	size_t count = population->modules.size();
+	double instanceFrames = (double) frames * count;
+	// the share of one real time frame the whole population takes, 100% is the capacity limit
+	double load = ns / frames * sampleRate / 1e9 * 100.0;
+
+	printf("%-16s %6zu %10.1f %8.1f%%", name, count, ns / instanceFrames, load);
+	if (counters->available) {
+		printf(" %6.2f %10.2f %10.3f", values.ipc(),
+			values.v[COUNTER_L1D_MISSES] / instanceFrames, values.v[COUNTER_LLC_MISSES] / instanceFrames);
+	} else {
+		printf(" %6s %10s %10s", "n/a", "n/a", "n/a");
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	std::vector<std::string> slugs;
+	std::vector<int> counts = {1, 16, 64, 256, 512};
+	int frames = 1 << 14;
+	float sampleRate = 48000.f;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--models" && i + 1 < argc) {
+			slugs = string::split(argv[++i], ",");
+		} else if (arg == "--counts" && i + 1 < argc) {
+			counts = parseList(argv[++i]);
+		} else if (arg == "--frames" && i + 1 < argc) {
+			frames = std::max(256, atoi(argv[++i]));
+		} else if (arg == "--rate" && i + 1 < argc) {
+			sampleRate = std::max(1000.f, (float) atof(argv[++i]));
+		} else {
+			fprintf(stderr, "usage: %s [--models A,B,...] [--counts 1,16,...] [--frames N] [--rate HZ]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	uint32_t state = 1;
+	for (int i = 0; i < STRESS_NOISE_FRAMES + 16; i++) {
+		state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+		noise[i] = 5.f * (int32_t) state / 2147483648.f;
+	}
+
+	HeadlessRack rack;
+	rack.start(sampleRate);
+
+	std::vector<plugin::Model *> models;
+	if (slugs.empty()) {
+		models = std::vector<plugin::Model *>(rack.plugin->models.begin(), rack.plugin->models.end());
+	}
+	for (const std::string &slug : slugs) {
+		plugin::Model *model = rack.findModel(slug);
+		if (!model) {
+			fprintf(stderr, "unknown model %s\n", slug.c_str());
+			rack.stop();
+			return 1;
+		}
+		models.push_back(model);
+	}
+
+	HardwareCounters counters;
+
+	printf("%d frames per measurement at %.0f Hz%s\n\n", frames, sampleRate,
+		counters.available ? "" : ", hardware counters unavailable");
+	printf("%-16s %6s %10s %9s %6s %10s %10s\n", "model", "count", "ns/inst", "load", "IPC", "L1D miss", "LLC miss");
+
+	for (plugin::Model *model : models) {
+		for (int count : counts) {
+			Population population;
+			for (int i = 0; i < count; i++) {
+				population.add(model);
+			}
+			measure(model->slug.c_str(), &population, frames, sampleRate, &counters);
+		}
+		printf("\n");
+	}
+
+	// a real patch interleaves different modules, so each instance's code and state evict the last one's
+	if (models.size() > 1) {
+		for (int count : counts) {
+			Population population;
+			for (int i = 0; i < count; i++) {
+				population.add(models[i % models.size()]);
+			}
+			measure("mixed", &population, frames, sampleRate, &counters);
+		}
+	}
+
+	rack.stop();
+	return 0;
+}
@@ -0,0 +1,491 @@
+#include "headless.hpp"
+#include "../src/trs.hpp"
+#include "../src/convolver.hpp"
+
+// trs-verify [--samples N]
+// Differential checks of the optimised paths against plain references, run before merging any change to a
+// hot kernel. Each check prints its largest error against its tolerance, a tolerance of 0 means bit exact,
+// and the tool exits non zero when any check fails.
+//
+//   kernels   float_4 oversamplers against the float ones lane by lane, packed voice pairs and the handlers'
+//             float_4 getLeft / getRight against their scalar reads, StereoMatrix, StereoPhaser and the
+//             partitioned convolver against scalar or direct references, StereoPhaser also against the
+//             starling-dsp ZDFPhaser4 / ZDFPhaser8 it replaced in TRSPHASER.
+//   lanes     every model with the same signal on all 8 voices, each voice has to match voice 0 of its side.
+//             TRSCONV runs a response built in memory and is allowed transform rounding between voices.
+//             TRSPHASER, TRSBBD and TRSCHAIN only write voice 0 of each side and are skipped.
+//   block     the block modes against the same model per sample, one block later.
+//
+// The plugin is built for a single instruction set, so there are no SSE / AVX variants to compare here.
+
+static int samples = 1 << 14;
+static int failures = 0;
+
+static uint32_t noiseState = 1;
+
+static float noise(void) {
+	noiseState ^= noiseState << 13; noiseState ^= noiseState >> 17; noiseState ^= noiseState << 5;
+	return (int32_t) noiseState / 2147483648.f;
+}
+
+static void report(const char *group, std::string name, double error, double tolerance) {
+	bool pass = (tolerance == 0.0) ? error == 0.0 : error <= tolerance;
+	failures += !pass;
+	printf("%-4s %-7s %-48s %12.3g %12.3g\n", pass ? "ok" : "FAIL", group, name.c_str(), error, tolerance);
+}
+
+inline double laneError(float_4 x, const float *reference) {
+	double error = 0.0;
+	for (int i = 0; i < 4; i++) {
+		error = std::max(error, (double) std::fabs(x[i] - reference[i]));
+	}
+	return error;
+}
+
+/** UpsamplePow2 into DecimatePow2 on float_4 against four float chains, each fed one lane's signal. */
+template <int OVERSAMPLE>
+static void checkOversampler(int factor) {
+	trs::UpsamplePow2<OVERSAMPLE, float_4> up4;
+	trs::DecimatePow2<OVERSAMPLE, float_4> down4;
+	trs::UpsamplePow2<OVERSAMPLE, float> up[4];
+	trs::DecimatePow2<OVERSAMPLE, float> down[4];
+	up4.setFactor(factor);
+	down4.setFactor(factor);
+	for (int lane = 0; lane < 4; lane++) {
+		up[lane].setFactor(factor);
+		down[lane].setFactor(factor);
+	}
+
+	float_4 buffer4[OVERSAMPLE];
+	float buffer[OVERSAMPLE];
+	double error = 0.0;
+	for (int i = 0; i < samples; i++) {
+		float in[4] = {noise(), noise(), noise(), noise()};
+		up4.process(float_4::load(in), buffer4);
+		float_4 out4 = down4.process(buffer4);
+		for (int lane = 0; lane < 4; lane++) {
+			up[lane].process(in[lane], buffer);
+			float out = down[lane].process(buffer);
+			error = std::max(error, (double) std::fabs(out4[lane] - out));
+		}
+	}
+	report("kernel", string::f("Up/DecimatePow2<%d> x%d round trip", OVERSAMPLE, factor), error, 0.0);
+}
+
+/** The upsampled stream itself, float_4 against float, before any decimation touches it. */
+template <int OVERSAMPLE>
+static void checkUpsampler(int factor) {
+	trs::UpsamplePow2<OVERSAMPLE, float_4> up4;
+	trs::UpsamplePow2<OVERSAMPLE, float> up[4];
+	up4.setFactor(factor);
+	for (int lane = 0; lane < 4; lane++) {
+		up[lane].setFactor(factor);
+	}
+	float_4 buffer4[OVERSAMPLE];
+	float buffer[OVERSAMPLE];
+	double error = 0.0;
+	for (int i = 0; i < samples; i++) {
+		float in[4] = {noise(), noise(), noise(), noise()};
+		up4.process(float_4::load(in), buffer4);
+		for (int lane = 0; lane < 4; lane++) {
+			up[lane].process(in[lane], buffer);
+			for (int k = 0; k < up4.factor; k++) {
+				error = std::max(error, (double) std::fabs(buffer4[k][lane] - buffer[k]));
+			}
+		}
+	}
+	report("kernel", string::f("UpsamplePow2<%d> x%d", OVERSAMPLE, factor), error, 0.0);
+}
+
+/** loadVoicePair / storeVoicePair against reading the channels one at a time. */
+static void checkVoicePairs(void) {
+	float channels[16];
+	float back[16];
+	double error = 0.0;
+	for (int i = 0; i < samples; i++) {
+		for (int c = 0; c < 16; c++) {
+			channels[c] = noise();
+		}
+		for (int pair = 0; pair < VOICE_PAIRS; pair++) {
+			float reference[4] = {channels[2 * pair], channels[2 * pair + 1], channels[8 + 2 * pair], channels[9 + 2 * pair]};
+			float_4 packed = loadVoicePair(channels + 2 * pair, channels + 8 + 2 * pair);
+			error = std::max(error, laneError(packed, reference));
+			storeVoicePair(back + 2 * pair, back + 8 + 2 * pair, packed);
+		}
+		for (int c = 0; c < 16; c++) {
+			error = std::max(error, (double) std::fabs(back[c] - channels[c]));
+		}
+	}
+	report("kernel", "voice pair load and store", error, 0.0);
+}
+
+/** The handlers' float_4 reads and writes against their scalar ones and the port's own channels. */
+static void checkHandlers(void) {
+	engine::Input input;
+	engine::Output output;
+	StereoInHandler in;
+	StereoOutHandler out;
+	in.configure(&input);
+	out.configure(&output);
+	output.setChannels(16);
+
+	double error = 0.0;
+	double normalError = 0.0;
+	for (int i = 0; i < samples; i++) {
+		// every other pass unpatched, so the normalled reads take their other branch
+		input.channels = (i & 1) ? 16 : 0;
+		for (int c = 0; c < 16; c++) {
+			input.voltages[c] = 5.f * noise();
+		}
+		error = std::max(error, (double) std::fabs(in.getLeft() - in.getLeft(0)[0]));
+		error = std::max(error, (double) std::fabs(in.getRight() - in.getRight(0)[0]));
+		for (int section = 0; section < 2; section++) {
+			error = std::max(error, laneError(in.getLeft(section), input.voltages + 4 * section));
+			error = std::max(error, laneError(in.getRight(section), input.voltages + 8 + 4 * section));
+		}
+		float firstPair[4] = {in.getLeft(), input.voltages[1], in.getRight(), input.voltages[9]};
+		error = std::max(error, laneError(in.getPair(0), firstPair));
+
+		float normal = noise();
+		normalError = std::max(normalError, (double) std::fabs(in.getLeftNormal(normal) - in.getLeftNormal(float_4(normal), 0)[0]));
+		normalError = std::max(normalError, (double) std::fabs(in.getRightNormal(normal) - in.getRightNormal(float_4(normal), 0)[0]));
+
+		float left = noise();
+		float right = noise();
+		out.setLeft(float_4(left + 1.f), 0);
+		out.setRight(float_4(right + 1.f), 0);
+		out.setLeft(left);
+		out.setRight(right);
+		error = std::max(error, (double) std::fabs(output.voltages[0] - left));
+		error = std::max(error, (double) std::fabs(output.voltages[8] - right));
+		error = std::max(error, (double) std::fabs(output.voltages[1] - (left + 1.f)));
+		error = std::max(error, (double) std::fabs(output.voltages[9] - (right + 1.f)));
+	}
+	report("kernel", "StereoIn/OutHandler scalar vs float_4", error, 0.0);
+	report("kernel", "StereoInHandler normalled scalar vs float_4", normalError, 0.0);
+}
+
+/** StereoMatrix against the 2x2 mix written out per channel in double. */
+static void checkStereoMatrix(void) {
+	StereoMatrix matrix;
+	float in[16];
+	float out[16];
+	double error = 0.0;
+	for (int i = 0; i < samples; i++) {
+		float c[4][8];
+		for (int chunk = 0; chunk < 2; chunk++) {
+			float ll[4], rl[4], lr[4], rr[4];
+			for (int lane = 0; lane < 4; lane++) {
+				ll[lane] = c[0][4 * chunk + lane] = noise();
+				rl[lane] = c[1][4 * chunk + lane] = noise();
+				lr[lane] = c[2][4 * chunk + lane] = noise();
+				rr[lane] = c[3][4 * chunk + lane] = noise();
+			}
+			matrix.setChunk(chunk, float_4::load(ll), float_4::load(rl), float_4::load(lr), float_4::load(rr));
+		}
+		for (int ch = 0; ch < 16; ch++) {
+			in[ch] = 5.f * noise();
+		}
+		matrix.process(in, out);
+		for (int v = 0; v < 8; v++) {
+			double left = (double) c[0][v] * in[v] + (double) c[1][v] * in[8 + v];
+			double right = (double) c[2][v] * in[v] + (double) c[3][v] * in[8 + v];
+			error = std::max(error, std::max(std::fabs(out[v] - left), std::fabs(out[8 + v] - right)));
+		}
+	}
+	// two products and a sum of 5 V signals, a couple of float ulps either way
+	report("kernel", "StereoMatrix", error, 5e-6);
+}
+
+/** The phaser as a scalar cascade in double, its feedback loop solved by running the stages on zero input first. */
+template <int POLES>
+struct ReferencePhaser {
+
+	double state[POLES] = {};
+	double G = 0.0;
+	double fb = 0.0;
+
+	void setParams(float normal, float feedback) {
+		double g = normalToG(normal);
+		G = g / (1.0 + g);
+		fb = feedback;
+	}
+
+	double stage(double x, double *s) const {
+		double v = G * (x - *s);
+		double lp = v + *s;
+		*s = lp + v;
+		return lp + lp - x;
+	}
+
+	double process(double in) {
+		// the cascade is affine in its input, its response to 0 and to 1 give the loop's solution
+		double zero[POLES];
+		double one[POLES];
+		std::memcpy(zero, state, sizeof(state));
+		std::memcpy(one, state, sizeof(state));
+		double fromState = 0.0;
+		double unit = 1.0;
+		for (int p = 0; p < POLES; p++) {
+			fromState = stage(fromState, &zero[p]);
+			unit = stage(unit, &one[p]);
+		}
+		double gain = unit - fromState;
+		double out = (gain * in + fromState) / (1.0 - fb * gain);
+
+		double x = in + fb * out;
+		for (int p = 0; p < POLES; p++) {
+			x = stage(x, &state[p]);
+		}
+		return x;
+	}
+
+};
+
+template <int POLES>
+static void checkPhaser(void) {
+	StereoPhaser<POLES> phaser;
+	ReferencePhaser<POLES> reference[2];
+	double error = 0.0;
+	double spareError = 0.0;
+	for (int i = 0; i < samples; i++) {
+		// sweep slowly so the coefficient cache is exercised without rebuilding every sample
+		float normal = .01f + .2f * (.5f + .5f * std::sin(i * 1e-3f));
+		float normalR = normal * 1.5f;
+		float feedback = .7f;
+		if ((i & 63) == 0) {
+			phaser.setParams(normal, normalR, feedback);
+			reference[0].setParams(normal, feedback);
+			reference[1].setParams(normalR, feedback);
+		}
+		float in = noise();
+		float_4 out = phaser.process(float_4(in, in, in, in));
+		error = std::max(error, std::fabs(out[0] - reference[0].process(in)));
+		error = std::max(error, std::fabs(out[1] - reference[1].process(in)));
+		// the unused lanes run the same cutoff as each other, so they have to agree exactly
+		spareError = std::max(spareError, (double) std::fabs(out[2] - out[3]));
+	}
+	report("kernel", string::f("StereoPhaser<%d> vs scalar cascade", POLES), error, 1e-4);
+	report("kernel", string::f("StereoPhaser<%d> spare lanes", POLES), spareError, 0.0);
+}
+
+/** StereoPhaser against the starling-dsp phaser TRSPHASER ran before, so patches keep their sound. */
+template <int POLES, typename Starling>
+static void checkStarlingPhaser(const char *name) {
+	StereoPhaser<POLES> phaser;
+	Starling starling[2];
+	double error = 0.0;
+	for (int i = 0; i < samples; i++) {
+		float normal = .01f + .2f * (.5f + .5f * std::sin(i * 1e-3f));
+		float normalR = normal * 1.5f;
+		float feedback = .25f + .2f * std::sin(i * 3e-4f);
+		if ((i & 63) == 0) {
+			phaser.setParams(normal, normalR, feedback);
+			starling[0].setParams(normal, feedback);
+			starling[1].setParams(normalR, feedback);
+		}
+		float in = noise();
+		float_4 out = phaser.process(float_4(in, in, 0.f, 0.f));
+		error = std::max(error, (double) std::fabs(out[0] - starling[0].process(in)));
+		error = std::max(error, (double) std::fabs(out[1] - starling[1].process(in)));
+	}
+	report("kernel", string::f("StereoPhaser<%d> vs %s", POLES, name), error, 1e-4);
+}
+
+/** The partitioned convolver against direct convolution, one block of latency apart. */
+static void checkConvolver(bool stereo) {
+	const int irLength = 3 * CONV_BLOCK + 37;
+	std::vector<dsp::Frame<2>> ir(irLength);
+	for (int i = 0; i < irLength; i++) {
+		float decay = std::exp(-4.f * i / irLength);
+		ir[i].samples[0] = decay * noise();
+		ir[i].samples[1] = stereo ? decay * noise() : ir[i].samples[0];
+	}
+	ConvolutionEngine *engine = ConvolutionEngine::build(ir, stereo, 48000.f);
+
+	const int length = std::min(samples, 8 * CONV_BLOCK * 8);
+	std::vector<float> in[2];
+	std::vector<float> out[2];
+	for (int side = 0; side < 2; side++) {
+		in[side].resize(length);
+		out[side].resize(length);
+		for (int i = 0; i < length; i++) {
+			in[side][i] = noise();
+		}
+	}
+	for (int i = 0; i < length; i++) {
+		out[0][i] = engine->process(0, in[0][i]);
+		out[1][i] = engine->process(8, in[1][i]);
+	}
+
+	double error = 0.0;
+	for (int side = 0; side < 2; side++) {
+		for (int i = 0; i + CONV_BLOCK < length; i++) {
+			double direct = 0.0;
+			for (int k = 0; k < irLength && k <= i; k++) {
+				direct += (double) ir[k].samples[side] * in[side][i - k];
+			}
+			error = std::max(error, std::fabs(out[side][i + CONV_BLOCK] - direct));
+		}
+	}
+	delete engine;
+	report("kernel", stereo ? "ConvolutionEngine stereo vs direct" : "ConvolutionEngine mono vs direct", error, 1e-4);
+}
+
+/** Runs `module` with the same signal on every voice of each side, returns the largest difference from voice 0. */
+static double voiceSpread(engine::Module *module, float sampleRate) {
+	engine::Module::ProcessArgs args;
+	args.sampleRate = sampleRate;
+	args.sampleTime = 1.f / sampleRate;
+	args.frame = 0;
+
+	for (engine::Input &input : module->inputs) {
+		input.channels = 16;
+	}
+	double error = 0.0;
+	for (int i = 0; i < samples; i++, args.frame++) {
+		float left = 5.f * noise();
+		float right = 5.f * noise();
+		for (engine::Input &input : module->inputs) {
+			for (int v = 0; v < 8; v++) {
+				input.voltages[v] = left;
+				input.voltages[8 + v] = right;
+			}
+		}
+		module->process(args);
+		for (engine::Output &output : module->outputs) {
+			int voices = std::min(output.channels, 8);
+			for (int v = 1; v < voices; v++) {
+				error = std::max(error, (double) std::fabs(output.voltages[v] - output.voltages[0]));
+			}
+			for (int v = 9; v < output.channels; v++) {
+				error = std::max(error, (double) std::fabs(output.voltages[v] - output.voltages[8]));
+			}
+		}
+	}
+	return error;
+}
+
+/** Runs `model` per sample and in block mode side by side, returns the largest difference one block apart. */
+static double blockError(plugin::Model *model, int blockSize, float sampleRate) {
+	engine::Module *reference = model->createModule();
+	engine::Module *blocked = model->createModule();
+	json_t *dataJ = json_object();
+	json_object_set_new(dataJ, "blockSize", json_integer(blockSize));
+	blocked->dataFromJson(dataJ);
+	json_decref(dataJ);
+	reference->onSampleRateChange();
+	blocked->onSampleRateChange();
+	installTestResponse(reference, sampleRate, .25f);
+	installTestResponse(blocked, sampleRate, .25f);
+
+	engine::Module::ProcessArgs args;
+	args.sampleRate = sampleRate;
+	args.sampleTime = 1.f / sampleRate;
+	args.frame = 0;
+
+	for (size_t i = 0; i < reference->inputs.size(); i++) {
+		reference->inputs[i].channels = 16;
+		blocked->inputs[i].channels = 16;
+	}
+
+	// reference output history, the block path answers `blockSize` samples later
+	std::vector<std::vector<float>> history(samples, std::vector<float>(16 * reference->outputs.size()));
+	double error = 0.0;
+	for (int i = 0; i < samples; i++, args.frame++) {
+		for (size_t p = 0; p < reference->inputs.size(); p++) {
+			for (int c = 0; c < 16; c++) {
+				float x = 5.f * noise();
+				reference->inputs[p].voltages[c] = x;
+				blocked->inputs[p].voltages[c] = x;
+			}
+		}
+		reference->process(args);
+		blocked->process(args);
+		for (size_t o = 0; o < reference->outputs.size(); o++) {
+			std::memcpy(&history[i][16 * o], reference->outputs[o].voltages, 16 * sizeof(float));
+			if (i >= blockSize) {
+				for (int c = 0; c < blocked->outputs[o].channels; c++) {
+					error = std::max(error, (double) std::fabs(blocked->outputs[o].voltages[c] - history[i - blockSize][16 * o + c]));
+				}
+			}
+		}
+	}
+	delete reference;
+	delete blocked;
+	return error;
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--samples" && i + 1 < argc) {
+			samples = std::max(4 * CONV_BLOCK, atoi(argv[++i]));
+		} else {
+			fprintf(stderr, "usage: %s [--samples N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const float sampleRate = 48000.f;
+	HeadlessRack rack;
+	rack.start(sampleRate);
+
+	printf("%-4s %-7s %-48s %12s %12s\n", "", "group", "check", "max error", "tolerance");
+
+	for (int factor = 1; factor <= 4; factor *= 2) {
+		checkUpsampler<4>(factor);
+		checkOversampler<4>(factor);
+	}
+	for (int factor = 8; factor <= 32; factor *= 2) {
+		checkUpsampler<32>(factor);
+		checkOversampler<32>(factor);
+	}
+	checkVoicePairs();
+	checkHandlers();
+	checkStereoMatrix();
+	checkPhaser<4>();
+	checkPhaser<8>();
+	checkStarlingPhaser<4, ZDFPhaser4>("ZDFPhaser4");
+	checkStarlingPhaser<8, ZDFPhaser8>("ZDFPhaser8");
+	checkConvolver(false);
+	checkConvolver(true);
+
+	// these only write the first voice of each side, there is nothing to compare it with
+	const char *firstVoiceModels[] = {"TRSPHASER", "TRSBBD", "TRSCHAIN"};
+	for (plugin::Model *model : rack.plugin->models) {
+		bool firstVoice = false;
+		for (const char *slug : firstVoiceModels) {
+			firstVoice |= model->slug == slug;
+		}
+		if (firstVoice) {
+			printf("%-4s %-7s %-48s\n", "skip", "lanes", (model->slug + ", first voice only").c_str());
+			continue;
+		}
+		engine::Module *module = model->createModule();
+		module->onSampleRateChange();
+		installTestResponse(module, sampleRate, .25f);
+		// the convolver staggers its voices' block boundaries, so each voice's transforms round differently
+		double tolerance = (model->slug == "TRSCONV") ? 1e-3 : 0.0;
+		report("lanes", model->slug, voiceSpread(module, sampleRate), tolerance);
+		delete module;
+	}
+
+	// the modules with a Block Processing menu
+	const char *blockModels[] = {"TRSVCF", "TRSPHASER", "TRSSINCOS", "TRSBBD"};
+	for (const char *slug : blockModels) {
+		plugin::Model *model = rack.findModel(slug);
+		if (!model) {
+			continue;
+		}
+		for (int size = 16; size <= 64; size *= 2) {
+			// control inputs are read once per sample either way, 1 mV covers coefficient rounding
+			report("block", string::f("%s, %d samples", slug, size), blockError(model, size, sampleRate), 1e-3);
+		}
+	}
+
+	rack.stop();
+
+	printf("\n%d check%s failed\n", failures, failures == 1 ? "" : "s");
+	return failures ? 1 : 0;
+}